@@ -164,6 +164,12 @@ int IME_Dialog_Display(int posx, int posy)
 }
 
 
+int IME_Dialog_IsRunning(void)
+{
+    return g_status == SCE_IME_DIALOG_STATUS_RUNNING;
+}
+
+
 int IME_Dialog_PullStatus(void)
 {
     SceImeDialogStatus status = sceImeDialogGetStatus();
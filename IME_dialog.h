@@ -64,6 +64,12 @@ int IME_Dialog_GetText(char* text, size_t size);
 int IME_Dialog_Display(int posx, int posy);
 
 
+/**
+ * Check if the dialog is currently displayed.
+ **/
+int IME_Dialog_IsRunning(void);
+
+
 /**
  * Get the state of the dialog, and signal changes to the calbback function.
  **/
@@ -0,0 +1,267 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define COMPOSE_BACKEND "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COMPOSE_BACKEND "sse2"
+#else
+#define COMPOSE_BACKEND "scalar"
+#endif
+
+#include "SDL_compose.h"
+
+
+/**
+ * Divide 16-bit products of two 8-bit values by 255, with rounding.
+ **/
+static inline Uint32 Compose_Div255(Uint32 x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+
+#if defined(__SSE2__)
+static inline __m128i Compose_Div255_128(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+
+/**
+ * Blend 4 pixels with the given per-pixel alpha (one value per 32-bit lane),
+ * where src holds the color unpacked to 16-bit channels.
+ **/
+static inline __m128i Compose_Blend4(__m128i d, __m128i a, __m128i src)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i max = _mm_set1_epi16(255);
+    __m128i alo, ahi, dlo, dhi;
+
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    alo = _mm_unpacklo_epi32(a, a);
+    ahi = _mm_unpackhi_epi32(a, a);
+
+    dlo = _mm_unpacklo_epi8(d, zero);
+    dhi = _mm_unpackhi_epi8(d, zero);
+    dlo = _mm_add_epi16(_mm_mullo_epi16(src, alo),
+			_mm_mullo_epi16(dlo, _mm_sub_epi16(max, alo)));
+    dhi = _mm_add_epi16(_mm_mullo_epi16(src, ahi),
+			_mm_mullo_epi16(dhi, _mm_sub_epi16(max, ahi)));
+
+    d = _mm_packus_epi16(Compose_Div255_128(dlo), Compose_Div255_128(dhi));
+    return _mm_or_si128(d, _mm_set1_epi32((int)0xff000000));
+}
+#endif
+
+
+#if defined(__AVX2__)
+static inline __m256i Compose_Div255_256(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+
+/**
+ * Same as Compose_Blend4, but for 8 pixels. Unpacking and packing operate
+ * within 128-bit lanes, so the pixel order is preserved.
+ **/
+static inline __m256i Compose_Blend8(__m256i d, __m256i a, __m256i src)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i max = _mm256_set1_epi16(255);
+    __m256i alo, ahi, dlo, dhi;
+
+    a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+    alo = _mm256_unpacklo_epi32(a, a);
+    ahi = _mm256_unpackhi_epi32(a, a);
+
+    dlo = _mm256_unpacklo_epi8(d, zero);
+    dhi = _mm256_unpackhi_epi8(d, zero);
+    dlo = _mm256_add_epi16(_mm256_mullo_epi16(src, alo),
+			   _mm256_mullo_epi16(dlo, _mm256_sub_epi16(max, alo)));
+    dhi = _mm256_add_epi16(_mm256_mullo_epi16(src, ahi),
+			   _mm256_mullo_epi16(dhi, _mm256_sub_epi16(max, ahi)));
+
+    d = _mm256_packus_epi16(Compose_Div255_256(dlo), Compose_Div255_256(dhi));
+    return _mm256_or_si256(d, _mm256_set1_epi32((int)0xff000000));
+}
+#endif
+
+
+static void Compose_FillSpan(Uint32* dst, int n, Uint32 argb)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    __m256i v8 = _mm256_set1_epi32((int)argb);
+    for(; i+8<=n; i+=8) {
+	_mm256_storeu_si256((__m256i*)(dst + i), v8);
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i v4 = _mm_set1_epi32((int)argb);
+    for(; i+4<=n; i+=4) {
+	_mm_storeu_si128((__m128i*)(dst + i), v4);
+    }
+#endif
+    for(; i<n; i++) {
+	dst[i] = argb;
+    }
+}
+
+
+/**
+ * Blend a color onto a span of pixels. The coverage of each pixel is given
+ * by the alpha channel of the mask, or is full if there is no mask. Blocks
+ * of pixels without coverage are skipped.
+ **/
+static void Compose_BlendSpan(Uint32* dst, const Uint32* mask, int n,
+			      SDL_Color c)
+{
+    Uint32 rgb = ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | c.b;
+    Uint32 a, ia, rb, g;
+    int i = 0;
+
+#if defined(__AVX2__)
+    {
+	__m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)rgb),
+					   _mm256_setzero_si256());
+	__m256i ca = _mm256_set1_epi32(c.a);
+	__m256i cov = _mm256_set1_epi32(255);
+	__m256i a8;
+
+	for(; i+8<=n; i+=8) {
+	    if(mask) {
+		cov = _mm256_loadu_si256((const __m256i*)(mask + i));
+		cov = _mm256_srli_epi32(cov, 24);
+	    }
+	    a8 = Compose_Div255_256(_mm256_mullo_epi16(cov, ca));
+	    if(_mm256_testz_si256(a8, a8)) {
+		continue;
+	    }
+	    _mm256_storeu_si256((__m256i*)(dst + i),
+				Compose_Blend8(_mm256_loadu_si256((__m256i*)(dst + i)),
+					       a8, src));
+	}
+    }
+#endif
+#if defined(__SSE2__)
+    {
+	__m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)rgb),
+					_mm_setzero_si128());
+	__m128i ca = _mm_set1_epi32(c.a);
+	__m128i cov = _mm_set1_epi32(255);
+	__m128i a4;
+
+	for(; i+4<=n; i+=4) {
+	    if(mask) {
+		cov = _mm_loadu_si128((const __m128i*)(mask + i));
+		cov = _mm_srli_epi32(cov, 24);
+	    }
+	    a4 = Compose_Div255_128(_mm_mullo_epi16(cov, ca));
+	    if(_mm_movemask_epi8(_mm_cmpeq_epi32(a4, _mm_setzero_si128())) ==
+	       0xffff) {
+		continue;
+	    }
+	    _mm_storeu_si128((__m128i*)(dst + i),
+			     Compose_Blend4(_mm_loadu_si128((__m128i*)(dst + i)),
+					    a4, src));
+	}
+    }
+#endif
+    for(; i<n; i++) {
+	a = Compose_Div255((mask ? mask[i] >> 24 : 255) * c.a);
+	if(!a) {
+	    continue;
+	}
+	ia = 255 - a;
+	rb = (rgb & 0xff00ff) * a + (dst[i] & 0xff00ff) * ia + 0x800080;
+	g  = (rgb & 0x00ff00) * a + (dst[i] & 0x00ff00) * ia + 0x008000;
+	rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+	g  = ((g + ((g >> 8) & 0x00ff00)) >> 8) & 0x00ff00;
+	dst[i] = 0xff000000 | rb | g;
+    }
+}
+
+
+void Compose_FillRect(Uint32* pixels, int pitch, const SDL_Rect* rect,
+		      SDL_Color c)
+{
+    Uint32 argb = ((Uint32)c.a << 24) | ((Uint32)c.r << 16) |
+	((Uint32)c.g << 8) | c.b;
+    Uint8* row = (Uint8*)pixels + rect->y * pitch;
+
+    for(int i=0; i<rect->h; i++, row+=pitch) {
+	Compose_FillSpan((Uint32*)row + rect->x, rect->w, argb);
+    }
+}
+
+
+void Compose_BlendRect(Uint32* pixels, int pitch, const SDL_Rect* rect,
+		       SDL_Color c)
+{
+    Uint8* row = (Uint8*)pixels + rect->y * pitch;
+
+    if(c.a == 0xff) {
+	Compose_FillRect(pixels, pitch, rect, c);
+	return;
+    }
+
+    for(int i=0; i<rect->h; i++, row+=pitch) {
+	Compose_BlendSpan((Uint32*)row + rect->x, 0, rect->w, c);
+    }
+}
+
+
+void Compose_BlendMask(Uint32* pixels, int pitch, int x, int y,
+		       const Uint32* mask, int mask_pitch, int w, int h,
+		       SDL_Color c, const SDL_Rect* clip)
+{
+    int x0 = SDL_max(x, clip->x);
+    int y0 = SDL_max(y, clip->y);
+    int x1 = SDL_min(x + w, clip->x + clip->w);
+    int y1 = SDL_min(y + h, clip->y + clip->h);
+    const Uint8* src;
+    Uint8* dst;
+
+    if(x0 >= x1 || y0 >= y1) {
+	return;
+    }
+
+    src = (const Uint8*)mask + (y0 - y) * mask_pitch + (x0 - x) * 4;
+    dst = (Uint8*)pixels + y0 * pitch + x0 * 4;
+    for(int i=y0; i<y1; i++, src+=mask_pitch, dst+=pitch) {
+	Compose_BlendSpan((Uint32*)dst, (const Uint32*)src, x1 - x0, c);
+    }
+}
+
+
+const char* Compose_GetBackend(void)
+{
+    return COMPOSE_BACKEND;
+}
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
@@ -0,0 +1,62 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <SDL2/SDL.h>
+
+/**
+ * Compose provides primitives for drawing directly into opaque ARGB8888
+ * pixel buffers, e.g., a locked streaming texture. Spans are processed
+ * with AVX2 or SSE2 when the compiler targets those instruction sets, and
+ * with portable scalar code otherwise. Pitches are given in bytes.
+ **/
+
+
+/**
+ * Fill a rectangle with a color, replacing the pixels underneath.
+ **/
+void Compose_FillRect(Uint32* pixels, int pitch, const SDL_Rect* rect,
+		      SDL_Color c);
+
+
+/**
+ * Alpha blend a color onto a rectangle.
+ **/
+void Compose_BlendRect(Uint32* pixels, int pitch, const SDL_Rect* rect,
+		       SDL_Color c);
+
+
+/**
+ * Alpha blend a color onto the pixels at the given position, using the
+ * alpha channel of an ARGB8888 mask as coverage. The mask is clipped to
+ * the given clip rectangle.
+ **/
+void Compose_BlendMask(Uint32* pixels, int pitch, int x, int y,
+		       const Uint32* mask, int mask_pitch, int w, int h,
+		       SDL_Color c, const SDL_Rect* clip);
+
+
+/**
+ * Return the name of the instruction set used to process spans.
+ **/
+const char* Compose_GetBackend(void);
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
@@ -0,0 +1,954 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SDL_compose.h"
+#include "SDL_glyphatlas.h"
+
+
+#define GLYPHATLAS_MAGIC      "GLYPHATL"
+#define GLYPHATLAS_VERSION    1
+#define GLYPHATLAS_WIDTH      1024
+#define GLYPHATLAS_MIN_HEIGHT 256
+#define GLYPHATLAS_MAX_HEIGHT 2048
+#define GLYPHATLAS_PADDING    1
+
+
+typedef struct GlyphAtlas_Glyph
+{
+    Uint32 codepoint;
+    Uint16 x;
+    Uint16 y;
+    Uint16 w;
+    Uint16 h;
+    Sint16 advance;
+    Uint8  used;
+    Uint8  empty;
+} GlyphAtlas_Glyph;
+
+
+/**
+ * Header of an on-disk atlas cache. The header is followed by the glyph
+ * table, and the atlas pixels.
+ **/
+typedef struct GlyphAtlas_CacheHeader
+{
+    char   magic[8];
+    Uint32 version;
+    Uint32 glyph_size;
+    char   font_path[256];
+    Sint32 ptsize;
+    Sint32 style;
+    Sint32 hinting;
+    Sint32 width;
+    Sint32 height;
+    Sint32 shelf_x;
+    Sint32 shelf_y;
+    Sint32 shelf_h;
+    Sint32 area;
+    Sint32 count;
+    Sint64 font_size;
+    Sint64 font_mtime;
+} GlyphAtlas_CacheHeader;
+
+
+struct SDL_GlyphAtlas
+{
+    SDL_Renderer *renderer;
+    TTF_Font     *font;
+
+    // Atlas pixels, and the region that has not been uploaded yet
+    SDL_Surface  *surface;
+    SDL_Texture  *texture;
+    SDL_Rect      dirty;
+
+    // Shelf packing state
+    int shelf_x;
+    int shelf_y;
+    int shelf_h;
+    int area;
+
+    // Open addressing table of glyphs, keyed on codepoint
+    GlyphAtlas_Glyph *glyphs;
+    int               capacity;
+    int               count;
+
+    // Queued quads
+    SDL_Vertex *vertices;
+    int         nb_vertices;
+    int         max_vertices;
+    int        *indices;
+    int         nb_indices;
+    int         max_indices;
+
+    // On-disk cache, and the mapping that backs the pixels when loaded
+    char   *cache_path;
+    GlyphAtlas_CacheHeader header;
+    void   *mapping;
+    size_t  mapping_size;
+    int     modified;
+
+    GlyphAtlas_Stats stats;
+};
+
+
+/**
+ * Decode the next codepoint of a UTF-8 encoded string. Malformed sequences
+ * are substituted with U+FFFD.
+ **/
+static Uint32 GlyphAtlas_DecodeUTF8(const char** text)
+{
+    const Uint8* s = (const Uint8*)*text;
+    Uint32 cp;
+    int n;
+
+    if(s[0] < 0x80) {
+	cp = s[0];
+	n = 0;
+    } else if((s[0] & 0xe0) == 0xc0) {
+	cp = s[0] & 0x1f;
+	n = 1;
+    } else if((s[0] & 0xf0) == 0xe0) {
+	cp = s[0] & 0x0f;
+	n = 2;
+    } else if((s[0] & 0xf8) == 0xf0) {
+	cp = s[0] & 0x07;
+	n = 3;
+    } else {
+	*text += 1;
+	return 0xfffd;
+    }
+
+    for(int i=1; i<=n; i++) {
+	if((s[i] & 0xc0) != 0x80) {
+	    *text += i;
+	    return 0xfffd;
+	}
+	cp = (cp << 6) | (s[i] & 0x3f);
+    }
+
+    *text += n + 1;
+    return cp;
+}
+
+
+static SDL_Texture* GlyphAtlas_CreateTexture(SDL_GlyphAtlas* a)
+{
+    SDL_Texture* texture;
+
+    if(!(texture=SDL_CreateTexture(a->renderer, SDL_PIXELFORMAT_ARGB8888,
+				   SDL_TEXTUREACCESS_STATIC, a->surface->w,
+				   a->surface->h))) {
+	return 0;
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+    a->dirty.x = a->dirty.y = 0;
+    a->dirty.w = a->surface->w;
+    a->dirty.h = a->surface->h;
+
+    return texture;
+}
+
+
+static void GlyphAtlas_MarkDirty(SDL_GlyphAtlas* a, int x, int y, int w, int h)
+{
+    int x1, y1;
+
+    if(!a->dirty.w || !a->dirty.h) {
+	a->dirty.x = x;
+	a->dirty.y = y;
+	a->dirty.w = w;
+	a->dirty.h = h;
+	return;
+    }
+
+    x1 = SDL_max(a->dirty.x + a->dirty.w, x + w);
+    y1 = SDL_max(a->dirty.y + a->dirty.h, y + h);
+    a->dirty.x = SDL_min(a->dirty.x, x);
+    a->dirty.y = SDL_min(a->dirty.y, y);
+    a->dirty.w = x1 - a->dirty.x;
+    a->dirty.h = y1 - a->dirty.y;
+}
+
+
+static void GlyphAtlas_Unmap(SDL_GlyphAtlas* a)
+{
+    if(a->mapping) {
+	munmap(a->mapping, a->mapping_size);
+	a->mapping = 0;
+	a->mapping_size = 0;
+    }
+}
+
+
+/**
+ * Double the height of the atlas, keeping all glyphs at their positions.
+ **/
+static int GlyphAtlas_Grow(SDL_GlyphAtlas* a)
+{
+    SDL_Surface* surface;
+    SDL_Texture* texture;
+
+    if(a->surface->h >= GLYPHATLAS_MAX_HEIGHT) {
+	return -1;
+    }
+
+    if(!(surface=SDL_CreateRGBSurfaceWithFormat(0, a->surface->w,
+						a->surface->h * 2, 32,
+						SDL_PIXELFORMAT_ARGB8888))) {
+	return -1;
+    }
+
+    SDL_SetSurfaceBlendMode(a->surface, SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(a->surface, NULL, surface, NULL);
+    SDL_FreeSurface(a->surface);
+    GlyphAtlas_Unmap(a);
+    a->surface = surface;
+
+    if(!(texture=GlyphAtlas_CreateTexture(a))) {
+	return -1;
+    }
+    SDL_DestroyTexture(a->texture);
+    a->texture = texture;
+
+    return 0;
+}
+
+
+/**
+ * Forget all glyphs in the atlas. Queued quads refer to the current content
+ * of the atlas, and are therefore submitted first.
+ **/
+static void GlyphAtlas_Reset(SDL_GlyphAtlas* a)
+{
+    GlyphAtlas_Flush(a);
+
+    SDL_memset(a->glyphs, 0, sizeof(GlyphAtlas_Glyph) * a->capacity);
+    SDL_FillRect(a->surface, NULL, 0);
+    a->count = 0;
+    a->area = 0;
+    a->shelf_x = a->shelf_y = a->shelf_h = 0;
+    a->modified = 1;
+    GlyphAtlas_MarkDirty(a, 0, 0, a->surface->w, a->surface->h);
+}
+
+
+/**
+ * Reserve a region of the atlas using a simple shelf packer.
+ **/
+static int GlyphAtlas_Pack(SDL_GlyphAtlas* a, int w, int h, int* x, int* y)
+{
+    w += GLYPHATLAS_PADDING;
+    h += GLYPHATLAS_PADDING;
+
+    if(w > a->surface->w || h > GLYPHATLAS_MAX_HEIGHT) {
+	return -1;
+    }
+
+    if(a->shelf_x + w > a->surface->w) {
+	a->shelf_y += a->shelf_h;
+	a->shelf_x = a->shelf_h = 0;
+    }
+
+    while(a->shelf_y + h > a->surface->h) {
+	if(GlyphAtlas_Grow(a)) {
+	    GlyphAtlas_Reset(a);
+	    break;
+	}
+    }
+
+    *x = a->shelf_x;
+    *y = a->shelf_y;
+    a->shelf_x += w;
+    a->shelf_h = SDL_max(a->shelf_h, h);
+    a->area += w * h;
+
+    return 0;
+}
+
+
+static GlyphAtlas_Glyph* GlyphAtlas_Probe(GlyphAtlas_Glyph* glyphs,
+					  int capacity, Uint32 cp)
+{
+    Uint32 i = (cp * 2654435761U) & (capacity - 1);
+
+    while(glyphs[i].used && glyphs[i].codepoint != cp) {
+	i = (i + 1) & (capacity - 1);
+    }
+
+    return &glyphs[i];
+}
+
+
+static int GlyphAtlas_Rehash(SDL_GlyphAtlas* a)
+{
+    int capacity = a->capacity ? a->capacity * 2 : 256;
+    GlyphAtlas_Glyph* glyphs;
+    GlyphAtlas_Glyph* g;
+
+    if(!(glyphs=SDL_calloc(capacity, sizeof(GlyphAtlas_Glyph)))) {
+	return -1;
+    }
+
+    for(int i=0; i<a->capacity; i++) {
+	if(a->glyphs[i].used) {
+	    g = GlyphAtlas_Probe(glyphs, capacity, a->glyphs[i].codepoint);
+	    *g = a->glyphs[i];
+	}
+    }
+
+    SDL_free(a->glyphs);
+    a->glyphs = glyphs;
+    a->capacity = capacity;
+
+    return 0;
+}
+
+
+/**
+ * Copy a rasterized glyph into the atlas. The surface is not freed.
+ **/
+static void GlyphAtlas_Place(SDL_GlyphAtlas* a, GlyphAtlas_Glyph* g,
+			     SDL_Surface* surface)
+{
+    SDL_Rect rect;
+    Uint32* row;
+    int x, y;
+
+    g->empty = 1;
+    if(!surface) {
+	return;
+    }
+
+    // Whitespace has no coverage, and need not occupy space in the atlas
+    SDL_LockSurface(surface);
+    for(int i=0; i<surface->h && g->empty; i++) {
+	row = (Uint32*)((Uint8*)surface->pixels + i * surface->pitch);
+	for(int j=0; j<surface->w; j++) {
+	    if(row[j] >> 24) {
+		g->empty = 0;
+		break;
+	    }
+	}
+    }
+    SDL_UnlockSurface(surface);
+
+    if(!g->empty && !GlyphAtlas_Pack(a, surface->w, surface->h, &x, &y)) {
+	rect.x = g->x = x;
+	rect.y = g->y = y;
+	rect.w = g->w = surface->w;
+	rect.h = g->h = surface->h;
+
+	SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+	SDL_BlitSurface(surface, NULL, a->surface, &rect);
+	GlyphAtlas_MarkDirty(a, x, y, surface->w, surface->h);
+    } else {
+	g->empty = 1;
+    }
+}
+
+
+/**
+ * Rasterize a glyph into the atlas.
+ **/
+static int GlyphAtlas_Rasterize(SDL_GlyphAtlas* a, GlyphAtlas_Glyph* g)
+{
+    SDL_Color white = {0xff, 0xff, 0xff, 0xff};
+    int minx, maxx, miny, maxy, advance;
+    SDL_Surface* surface;
+
+    if(TTF_GlyphMetrics32(a->font, g->codepoint, &minx, &maxx, &miny, &maxy,
+			  &advance)) {
+	advance = 0;
+    }
+    g->advance = advance;
+
+    surface = TTF_RenderGlyph32_Blended(a->font, g->codepoint, white);
+    GlyphAtlas_Place(a, g, surface);
+    SDL_FreeSurface(surface);
+
+    return 0;
+}
+
+
+/**
+ * Insert a glyph that has been placed in the atlas into the table.
+ **/
+static GlyphAtlas_Glyph* GlyphAtlas_Insert(SDL_GlyphAtlas* a,
+					   const GlyphAtlas_Glyph* tmp)
+{
+    GlyphAtlas_Glyph* g;
+
+    a->modified = 1;
+    if((a->count + 1) * 2 > a->capacity && GlyphAtlas_Rehash(a)) {
+	return 0;
+    }
+
+    g = GlyphAtlas_Probe(a->glyphs, a->capacity, tmp->codepoint);
+    *g = *tmp;
+    a->count++;
+
+    return g;
+}
+
+
+static GlyphAtlas_Glyph* GlyphAtlas_GetGlyph(SDL_GlyphAtlas* a, Uint32 cp)
+{
+    GlyphAtlas_Glyph* g = GlyphAtlas_Probe(a->glyphs, a->capacity, cp);
+    GlyphAtlas_Glyph tmp = {0};
+
+    if(g->used) {
+	a->stats.hits++;
+	return g;
+    }
+
+    // Rasterizing may reset the atlas, so the glyph is inserted afterwards
+    a->stats.misses++;
+    tmp.codepoint = cp;
+    tmp.used = 1;
+    GlyphAtlas_Rasterize(a, &tmp);
+
+    return GlyphAtlas_Insert(a, &tmp);
+}
+
+
+static int GlyphAtlas_Reserve(SDL_GlyphAtlas* a, int quads)
+{
+    int max_vertices = a->max_vertices;
+    int max_indices = a->max_indices;
+    void* ptr;
+
+    while(a->nb_vertices + quads * 4 > max_vertices) {
+	max_vertices = max_vertices ? max_vertices * 2 : 1024;
+    }
+    while(a->nb_indices + quads * 6 > max_indices) {
+	max_indices = max_indices ? max_indices * 2 : 1536;
+    }
+
+    if(max_vertices != a->max_vertices) {
+	if(!(ptr=SDL_realloc(a->vertices, max_vertices * sizeof(SDL_Vertex)))) {
+	    return -1;
+	}
+	a->vertices = ptr;
+	a->max_vertices = max_vertices;
+    }
+    if(max_indices != a->max_indices) {
+	if(!(ptr=SDL_realloc(a->indices, max_indices * sizeof(int)))) {
+	    return -1;
+	}
+	a->indices = ptr;
+	a->max_indices = max_indices;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Queue a quad. Texture coordinates are kept in pixels until the batch is
+ * flushed, since the atlas may grow in the meantime.
+ **/
+static void GlyphAtlas_PushQuad(SDL_GlyphAtlas* a, GlyphAtlas_Glyph* g,
+				int x, int y, SDL_Color color)
+{
+    SDL_Vertex* v;
+    int* i;
+
+    if(GlyphAtlas_Reserve(a, 1)) {
+	return;
+    }
+
+    v = a->vertices + a->nb_vertices;
+    i = a->indices + a->nb_indices;
+
+    v[0].position.x = x;
+    v[0].position.y = y;
+    v[0].tex_coord.x = g->x;
+    v[0].tex_coord.y = g->y;
+
+    v[1].position.x = x + g->w;
+    v[1].position.y = y;
+    v[1].tex_coord.x = g->x + g->w;
+    v[1].tex_coord.y = g->y;
+
+    v[2].position.x = x + g->w;
+    v[2].position.y = y + g->h;
+    v[2].tex_coord.x = g->x + g->w;
+    v[2].tex_coord.y = g->y + g->h;
+
+    v[3].position.x = x;
+    v[3].position.y = y + g->h;
+    v[3].tex_coord.x = g->x;
+    v[3].tex_coord.y = g->y + g->h;
+
+    v[0].color = v[1].color = v[2].color = v[3].color = color;
+
+    i[0] = a->nb_vertices + 0;
+    i[1] = a->nb_vertices + 1;
+    i[2] = a->nb_vertices + 2;
+    i[3] = a->nb_vertices + 0;
+    i[4] = a->nb_vertices + 2;
+    i[5] = a->nb_vertices + 3;
+
+    a->nb_vertices += 4;
+    a->nb_indices += 6;
+}
+
+
+SDL_GlyphAtlas* GlyphAtlas_Create(SDL_Renderer* renderer, TTF_Font* font)
+{
+    SDL_GlyphAtlas* a = SDL_calloc(1, sizeof(SDL_GlyphAtlas));
+
+    a->renderer = renderer;
+    a->font = font;
+
+    if(!(a->surface=SDL_CreateRGBSurfaceWithFormat(0, GLYPHATLAS_WIDTH,
+						   GLYPHATLAS_MIN_HEIGHT, 32,
+						   SDL_PIXELFORMAT_ARGB8888))) {
+	GlyphAtlas_Destroy(a);
+	return 0;
+    }
+    if(!(a->texture=GlyphAtlas_CreateTexture(a))) {
+	GlyphAtlas_Destroy(a);
+	return 0;
+    }
+    if(GlyphAtlas_Rehash(a)) {
+	GlyphAtlas_Destroy(a);
+	return 0;
+    }
+
+    return a;
+}
+
+
+void GlyphAtlas_Destroy(SDL_GlyphAtlas* a)
+{
+    if(a->texture) {
+	SDL_DestroyTexture(a->texture);
+    }
+    if(a->surface) {
+	SDL_FreeSurface(a->surface);
+    }
+    GlyphAtlas_Unmap(a);
+
+    SDL_free(a->cache_path);
+    SDL_free(a->glyphs);
+    SDL_free(a->vertices);
+    SDL_free(a->indices);
+    SDL_free(a);
+}
+
+
+SDL_bool GlyphAtlas_Matches(SDL_GlyphAtlas* a, SDL_Renderer* renderer,
+			    TTF_Font* font)
+{
+    return a->renderer == renderer && a->font == font;
+}
+
+
+int GlyphAtlas_DrawText(SDL_GlyphAtlas* a, const char* text, int x, int y,
+			SDL_Color color)
+{
+    GlyphAtlas_Glyph* g;
+    int pen = x;
+
+    while(*text) {
+	if(!(g=GlyphAtlas_GetGlyph(a, GlyphAtlas_DecodeUTF8(&text)))) {
+	    break;
+	}
+	if(!g->empty) {
+	    GlyphAtlas_PushQuad(a, g, pen, y, color);
+	}
+	pen += g->advance;
+    }
+
+    return pen - x;
+}
+
+
+int GlyphAtlas_BlitText(SDL_GlyphAtlas* a, const char* text, int x, int y,
+			SDL_Color color, Uint32* pixels, int pitch,
+			const SDL_Rect* clip)
+{
+    GlyphAtlas_Glyph* g;
+    Uint8* mask;
+    int pen = x;
+
+    while(*text) {
+	if(!(g=GlyphAtlas_GetGlyph(a, GlyphAtlas_DecodeUTF8(&text)))) {
+	    break;
+	}
+	if(!g->empty) {
+	    mask = (Uint8*)a->surface->pixels + g->y * a->surface->pitch +
+		g->x * 4;
+	    Compose_BlendMask(pixels, pitch, pen, y, (Uint32*)mask,
+			      a->surface->pitch, g->w, g->h, color, clip);
+	}
+	pen += g->advance;
+    }
+
+    return pen - x;
+}
+
+
+int GlyphAtlas_MeasureText(SDL_GlyphAtlas* a, const char* text)
+{
+    GlyphAtlas_Glyph* g;
+    int w = 0;
+
+    while(*text) {
+	if(!(g=GlyphAtlas_GetGlyph(a, GlyphAtlas_DecodeUTF8(&text)))) {
+	    break;
+	}
+	w += g->advance;
+    }
+
+    return w;
+}
+
+
+int GlyphAtlas_Flush(SDL_GlyphAtlas* a)
+{
+    float w = a->surface->w;
+    float h = a->surface->h;
+    Uint8* pixels;
+    int err;
+
+    if(!a->nb_indices) {
+	return 0;
+    }
+
+    if(a->dirty.w && a->dirty.h) {
+	pixels = (Uint8*)a->surface->pixels + a->dirty.y * a->surface->pitch +
+	    a->dirty.x * 4;
+	SDL_UpdateTexture(a->texture, &a->dirty, pixels, a->surface->pitch);
+	a->dirty.w = a->dirty.h = 0;
+    }
+
+    for(int i=0; i<a->nb_vertices; i++) {
+	a->vertices[i].tex_coord.x /= w;
+	a->vertices[i].tex_coord.y /= h;
+    }
+
+    err = SDL_RenderGeometry(a->renderer, a->texture, a->vertices,
+			     a->nb_vertices, a->indices, a->nb_indices);
+
+    a->stats.last_quads = a->nb_indices / 6;
+    a->stats.quads += a->stats.last_quads;
+    a->stats.batches++;
+    a->nb_vertices = a->nb_indices = 0;
+
+    return err;
+}
+
+
+int GlyphAtlas_Prebake(SDL_GlyphAtlas* a, const char* text)
+{
+    while(*text) {
+	if(!GlyphAtlas_GetGlyph(a, GlyphAtlas_DecodeUTF8(&text))) {
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+int GlyphAtlas_GetMissing(SDL_GlyphAtlas* a, const char* text,
+			  Uint32* codepoints, int max)
+{
+    GlyphAtlas_Glyph* g;
+    int n = 0;
+    Uint32 cp;
+
+    while(*text && n < max) {
+	cp = GlyphAtlas_DecodeUTF8(&text);
+	g = GlyphAtlas_Probe(a->glyphs, a->capacity, cp);
+	if(!g->used) {
+	    codepoints[n++] = cp;
+	}
+    }
+
+    return n;
+}
+
+
+int GlyphAtlas_InsertGlyph(SDL_GlyphAtlas* a, Uint32 codepoint,
+			   SDL_Surface* surface, int advance)
+{
+    GlyphAtlas_Glyph* g = GlyphAtlas_Probe(a->glyphs, a->capacity, codepoint);
+    GlyphAtlas_Glyph tmp = {0};
+
+    if(g->used) {
+	return 0;
+    }
+
+    tmp.codepoint = codepoint;
+    tmp.used = 1;
+    tmp.advance = advance;
+    GlyphAtlas_Place(a, &tmp, surface);
+
+    return GlyphAtlas_Insert(a, &tmp) ? 0 : -1;
+}
+
+
+/**
+ * Populate the atlas with glyphs from a mapped cache file. The atlas is left
+ * untouched if the file does not match the font of the atlas.
+ **/
+static int GlyphAtlas_Map(SDL_GlyphAtlas* a, void* mapping, size_t size)
+{
+    GlyphAtlas_CacheHeader* h = mapping;
+    GlyphAtlas_Glyph* glyphs;
+    GlyphAtlas_Glyph* table;
+    GlyphAtlas_Glyph* g;
+    SDL_Surface* surface;
+    SDL_Texture* texture;
+    SDL_Surface* prev;
+    size_t offset;
+    int capacity;
+    int count = 0;
+
+    if(size < sizeof(GlyphAtlas_CacheHeader)) {
+	return -1;
+    }
+    if(h->font_path[sizeof(h->font_path) - 1]) {
+	return -1;
+    }
+    if(SDL_memcmp(h->magic, a->header.magic, sizeof(h->magic)) ||
+       h->version != a->header.version ||
+       h->glyph_size != a->header.glyph_size ||
+       SDL_strcmp(h->font_path, a->header.font_path) ||
+       h->ptsize != a->header.ptsize || h->style != a->header.style ||
+       h->hinting != a->header.hinting ||
+       h->font_size != a->header.font_size ||
+       h->font_mtime != a->header.font_mtime) {
+	return -1;
+    }
+    if(h->width != GLYPHATLAS_WIDTH || h->height < GLYPHATLAS_MIN_HEIGHT ||
+       h->height > GLYPHATLAS_MAX_HEIGHT || h->count < 0) {
+	return -1;
+    }
+
+    offset = sizeof(GlyphAtlas_CacheHeader) +
+	(size_t)h->count * sizeof(GlyphAtlas_Glyph);
+    if(size != offset + (size_t)h->width * h->height * 4) {
+	return -1;
+    }
+
+    // The packer continues from the shelf, and glyphs are sampled from
+    // their rects, so neither may point outside of the atlas
+    if(h->shelf_x < 0 || h->shelf_x > h->width || h->shelf_y < 0 ||
+       h->shelf_h < 0 || h->shelf_y + h->shelf_h > h->height ||
+       h->area < 0) {
+	return -1;
+    }
+    glyphs = (GlyphAtlas_Glyph*)(h + 1);
+    for(int i=0; i<h->count; i++) {
+	g = &glyphs[i];
+	if(g->used != 1 || g->x + g->w > h->width ||
+	   g->y + g->h > h->height) {
+	    return -1;
+	}
+    }
+
+    for(capacity=256; capacity < h->count * 2; capacity *= 2);
+    if(!(table=SDL_calloc(capacity, sizeof(GlyphAtlas_Glyph)))) {
+	return -1;
+    }
+    for(int i=0; i<h->count; i++) {
+	g = GlyphAtlas_Probe(table, capacity, glyphs[i].codepoint);
+	count += !g->used;
+	*g = glyphs[i];
+    }
+
+    if(!(surface=SDL_CreateRGBSurfaceWithFormatFrom((Uint8*)mapping + offset,
+						    h->width, h->height, 32,
+						    h->width * 4,
+						    SDL_PIXELFORMAT_ARGB8888))) {
+	SDL_free(table);
+	return -1;
+    }
+
+    prev = a->surface;
+    a->surface = surface;
+    if(!(texture=GlyphAtlas_CreateTexture(a))) {
+	a->surface = prev;
+	SDL_FreeSurface(surface);
+	SDL_free(table);
+	return -1;
+    }
+
+    SDL_FreeSurface(prev);
+    SDL_DestroyTexture(a->texture);
+    SDL_free(a->glyphs);
+    a->texture = texture;
+    a->glyphs = table;
+    a->capacity = capacity;
+    a->count = count;
+    a->shelf_x = h->shelf_x;
+    a->shelf_y = h->shelf_y;
+    a->shelf_h = h->shelf_h;
+    a->area = h->area;
+
+    return 0;
+}
+
+
+int GlyphAtlas_Load(SDL_GlyphAtlas* a, const char* dir, const char* font_path,
+		    int ptsize)
+{
+    GlyphAtlas_CacheHeader* h = &a->header;
+    Uint32 hash = 2166136261U;
+    char path[PATH_MAX];
+    struct stat st;
+    void* mapping;
+    int fd;
+
+    if(stat(font_path, &st)) {
+	return -1;
+    }
+
+    SDL_memset(h, 0, sizeof(GlyphAtlas_CacheHeader));
+    SDL_memcpy(h->magic, GLYPHATLAS_MAGIC, sizeof(h->magic));
+    SDL_strlcpy(h->font_path, font_path, sizeof(h->font_path));
+    h->version = GLYPHATLAS_VERSION;
+    h->glyph_size = sizeof(GlyphAtlas_Glyph);
+    h->ptsize = ptsize;
+    h->style = TTF_GetFontStyle(a->font);
+    h->hinting = TTF_GetFontHinting(a->font);
+    h->font_size = st.st_size;
+    h->font_mtime = st.st_mtime;
+
+    // Each (font, size, style) gets a file of its own
+    for(const char* p=font_path; *p; p++) {
+	hash = (hash ^ (Uint8)*p) * 16777619U;
+    }
+    hash = (hash ^ (Uint32)ptsize) * 16777619U;
+    hash = (hash ^ (Uint32)h->style) * 16777619U;
+    SDL_snprintf(path, sizeof(path), "%s/atlas-%08x.bin", dir, hash);
+
+    SDL_free(a->cache_path);
+    a->cache_path = SDL_strdup(path);
+    a->modified = 1;
+
+    if((fd=open(path, O_RDONLY)) < 0) {
+	return -1;
+    }
+    if(fstat(fd, &st) || !st.st_size) {
+	close(fd);
+	return -1;
+    }
+
+    // Private writable pages, so that new glyphs can be added in place
+    mapping = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+	return -1;
+    }
+
+    if(GlyphAtlas_Map(a, mapping, st.st_size)) {
+	munmap(mapping, st.st_size);
+	return -1;
+    }
+
+    GlyphAtlas_Unmap(a);
+    a->mapping = mapping;
+    a->mapping_size = st.st_size;
+    a->modified = 0;
+
+    return 0;
+}
+
+
+int GlyphAtlas_Save(SDL_GlyphAtlas* a)
+{
+    GlyphAtlas_CacheHeader h = a->header;
+    char path[PATH_MAX];
+    FILE* fp;
+    int err = 0;
+
+    if(!a->cache_path || !a->modified) {
+	return 0;
+    }
+
+    h.width = a->surface->w;
+    h.height = a->surface->h;
+    h.shelf_x = a->shelf_x;
+    h.shelf_y = a->shelf_y;
+    h.shelf_h = a->shelf_h;
+    h.area = a->area;
+    h.count = a->count;
+
+    // Write to a temporary file, and replace the cache atomically
+    SDL_snprintf(path, sizeof(path), "%s.tmp", a->cache_path);
+    if(!(fp=fopen(path, "wb"))) {
+	return -1;
+    }
+
+    if(fwrite(&h, sizeof(h), 1, fp) != 1) {
+	err = -1;
+    }
+    for(int i=0; i<a->capacity && !err; i++) {
+	if(a->glyphs[i].used &&
+	   fwrite(&a->glyphs[i], sizeof(GlyphAtlas_Glyph), 1, fp) != 1) {
+	    err = -1;
+	}
+    }
+    for(int i=0; i<a->surface->h && !err; i++) {
+	if(fwrite((Uint8*)a->surface->pixels + i * a->surface->pitch,
+		  a->surface->w * 4, 1, fp) != 1) {
+	    err = -1;
+	}
+    }
+
+    if(fclose(fp) || err) {
+	unlink(path);
+	return -1;
+    }
+    if(rename(path, a->cache_path)) {
+	unlink(path);
+	return -1;
+    }
+
+    a->modified = 0;
+
+    return 0;
+}
+
+
+void GlyphAtlas_GetStats(SDL_GlyphAtlas* a, GlyphAtlas_Stats* stats)
+{
+    *stats = a->stats;
+    stats->glyphs = a->count;
+    stats->width = a->surface->w;
+    stats->height = a->surface->h;
+    stats->occupancy = (int)((Uint64)a->area * 100 /
+			     (a->surface->w * a->surface->h));
+}
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
@@ -0,0 +1,151 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+/**
+ * GlyphAtlas renders UTF-8 encoded text with a font whose glyphs are
+ * rasterized once, on first use, into a shared atlas texture. Text drawn
+ * with the atlas is queued as textured quads, and submitted to the renderer
+ * in a single batch when the atlas is flushed, e.g.,
+ *
+ *  GlyphAtlas_DrawText(atlas, "Title", x, y, color);
+ *  GlyphAtlas_DrawText(atlas, "Item 1", x, y + h, color);
+ *  GlyphAtlas_Flush(atlas);
+ **/
+struct SDL_GlyphAtlas;
+typedef struct SDL_GlyphAtlas SDL_GlyphAtlas;
+
+
+/**
+ * Statistics gathered by a GlyphAtlas instance.
+ **/
+typedef struct GlyphAtlas_Stats
+{
+    int    glyphs;     // number of glyphs in the atlas
+    int    width;      // width of the atlas texture, in pixels
+    int    height;     // height of the atlas texture, in pixels
+    int    occupancy;  // area occupied by glyphs, in percent of the atlas
+    Uint64 hits;       // glyph lookups served by the atlas
+    Uint64 misses;     // glyph lookups that had to be rasterized
+    Uint64 quads;      // quads emitted since the atlas was created
+    Uint64 batches;    // batches submitted since the atlas was created
+    int    last_quads; // quads emitted by the last batch
+} GlyphAtlas_Stats;
+
+
+/**
+ * Create a new GlyphAtlas instance for the given renderer and font.
+ **/
+SDL_GlyphAtlas* GlyphAtlas_Create(SDL_Renderer* renderer, TTF_Font* font);
+
+
+/**
+ * Free all memory associated with a GlyphAtlas instance.
+ **/
+void GlyphAtlas_Destroy(SDL_GlyphAtlas* a);
+
+
+/**
+ * Return SDL_TRUE if the atlas was created for the given renderer and font.
+ **/
+SDL_bool GlyphAtlas_Matches(SDL_GlyphAtlas* a, SDL_Renderer* renderer,
+			    TTF_Font* font);
+
+
+/**
+ * Queue UTF-8 encoded text at the given position, and return its width
+ * in pixels.
+ **/
+int GlyphAtlas_DrawText(SDL_GlyphAtlas* a, const char* text, int x, int y,
+			SDL_Color color);
+
+
+/**
+ * Blend UTF-8 encoded text directly into an ARGB8888 pixel buffer, clipped
+ * to the given rectangle, and return its width in pixels. The text is not
+ * queued, and the renderer is not involved.
+ **/
+int GlyphAtlas_BlitText(SDL_GlyphAtlas* a, const char* text, int x, int y,
+			SDL_Color color, Uint32* pixels, int pitch,
+			const SDL_Rect* clip);
+
+
+/**
+ * Compute the width in pixels of UTF-8 encoded text.
+ **/
+int GlyphAtlas_MeasureText(SDL_GlyphAtlas* a, const char* text);
+
+
+/**
+ * Submit all queued text to the renderer as a single batch.
+ **/
+int GlyphAtlas_Flush(SDL_GlyphAtlas* a);
+
+
+/**
+ * Rasterize all glyphs of UTF-8 encoded text into the atlas ahead of time.
+ **/
+int GlyphAtlas_Prebake(SDL_GlyphAtlas* a, const char* text);
+
+
+/**
+ * Store up to max codepoints of UTF-8 encoded text that are not in the atlas
+ * yet in the given array, and return how many were stored.
+ **/
+int GlyphAtlas_GetMissing(SDL_GlyphAtlas* a, const char* text,
+			  Uint32* codepoints, int max);
+
+
+/**
+ * Insert a glyph that was rasterized elsewhere, e.g., on another thread,
+ * with TTF_RenderGlyph32_Blended in white. A NULL surface inserts a glyph
+ * without coverage. The surface is not freed.
+ **/
+int GlyphAtlas_InsertGlyph(SDL_GlyphAtlas* a, Uint32 codepoint,
+			   SDL_Surface* surface, int advance);
+
+
+/**
+ * Bind the atlas to an on-disk cache in the given directory for the font
+ * at the given path and size, and map previously rasterized glyphs from
+ * the cache. Returns -1 if there is no cache yet, or if it is stale
+ * w.r.t. the font file, in which case it is rebuilt by GlyphAtlas_Save.
+ **/
+int GlyphAtlas_Load(SDL_GlyphAtlas* a, const char* dir, const char* font_path,
+		    int ptsize);
+
+
+/**
+ * Write the atlas to its on-disk cache if glyphs were added since it was
+ * loaded or saved.
+ **/
+int GlyphAtlas_Save(SDL_GlyphAtlas* a);
+
+
+/**
+ * Obtain statistics gathered by a GlyphAtlas instance.
+ **/
+void GlyphAtlas_GetStats(SDL_GlyphAtlas* a, GlyphAtlas_Stats* stats);
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
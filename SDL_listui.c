@@ -14,16 +14,90 @@ You should have received a copy of the GNU General Public License
 along with this program; see the file COPYING. If not, see
 <http://www.gnu.org/licenses/>.  */
 
+#include "SDL_compose.h"
 #include "SDL_listui.h"
 
 
+#define LISTUI_CACHE_BUCKETS 256
+#define LISTUI_CACHE_BUDGET  (16 * 1024 * 1024)
+#define LISTUI_PREFETCH_MAX  64 // glyphs requested per text and frame
+#define LISTUI_SLOT_BITS     32 // low bits of an item id hold its slot
+#define LISTUI_INLINE_TEXT   24 // bytes of text stored inline in a cell
+#define LISTUI_ARENA_CHUNK   (64 * 1024)
+#define LISTUI_ROW_CACHE     256 // rows of a data source that are cached
+#define LISTUI_GRAM_START    0x01 // pads the start of text in trigrams
+#define LISTUI_INDEX_SLICE   8192 // items added to the trigram index per call
+#define LISTUI_ITEM_ACTIVATE 0x1 // the item has an OnActivate listener
+#define LISTUI_PREBAKE_TEXT  " !\"#$%&'()*+,-./0123456789:;<=>?@"	\
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"
+
+
+/**
+ * The text in a column of an item, and a generation that is bumped each
+ * time the text changes. Short text is stored inline, and text points at
+ * it, so cells that are moved must have their text pointer fixed up.
+ **/
+typedef struct ListUI_Cell
+{
+    char   *text;
+    Uint32  generation;
+    char    inline_text[LISTUI_INLINE_TEXT];
+} ListUI_Cell;
+
+
+/**
+ * A chunk of memory that allocations are carved from.
+ **/
+typedef struct ListUI_Chunk
+{
+    struct ListUI_Chunk *next;
+    size_t               size;
+    size_t               used;
+    Uint8                data[];
+} ListUI_Chunk;
+
+
+/**
+ * Memory for cells and their text. Nothing is freed individually; the
+ * whole arena is reset at once, and its chunks are reused afterwards. Bytes
+ * that are no longer referenced are counted as wasted until then.
+ **/
+typedef struct ListUI_Arena
+{
+    ListUI_Chunk *first;
+    ListUI_Chunk *current;
+    size_t        used;
+    size_t        wasted;
+    size_t        high_water;
+    size_t        reserved;
+} ListUI_Arena;
+
+
+/**
+ * The fields of an item that are read when it is laid out, drawn or sorted.
+ * Items are stored contiguously in list order, and their cells live in the
+ * cell arena. The label is the text of the first cell, and the key is given
+ * by ListUI_Reconcile.
+ **/
 typedef struct ListUI_Item
 {
-    char               *label;
-    struct ListUI_Item *next;
-    struct ListUI_Item *prev;
+    Uint64       id;
+    Uint64       key;
+    Uint32       generation;
+    Uint32       flags;
+    char        *label;
+    ListUI_Cell *cells;
+    int          nb_cells;
+    int          max_cells;
+} ListUI_Item;
 
-    // Event listeners
+
+/**
+ * The event listeners of an item, stored apart from the item in an array
+ * that runs parallel to the items.
+ **/
+typedef struct ListUI_Listeners
+{
     struct {
 	ListUI_OnSelectCallback *fn;
 	void * ctx;
@@ -32,24 +106,295 @@ typedef struct ListUI_Item
 	ListUI_OnActivateCallback *fn;
 	void * ctx;
     } on_activate;
-} ListUI_Item;
+} ListUI_Listeners;
+
+
+/**
+ * The positions of items whose filtered text contains a trigram, in
+ * ascending order.
+ **/
+typedef struct ListUI_Posting
+{
+    Uint32  gram;
+    int     nb;
+    int     max;
+    int    *items;
+} ListUI_Posting;
+
+
+/**
+ * A row requested from a data source, cached by its position in the list.
+ * Entries that are not in use have a negative index.
+ **/
+typedef struct ListUI_CachedRow
+{
+    int         index;
+    ListUI_Item item;
+    ListUI_Cell cells[LISTUI_MAX_COLUMNS];
+} ListUI_CachedRow;
+
+
+/**
+ * An entry in the table that maps item ids to the position of items in the
+ * list. Ids combine the index of a slot with its generation, which is the
+ * epoch of the list when the slot was taken. ListUI_Clear starts a new
+ * epoch, and so does taking a slot that was released, so that ids of
+ * removed items are rejected rather than dereferenced. Released slots are
+ * linked through their index.
+ **/
+typedef struct ListUI_Slot
+{
+    Uint32 index;
+    Uint32 generation;
+} ListUI_Slot;
+
+
+/**
+ * A copy of an item, as published to the renderer.
+ **/
+typedef struct ListUI_SnapshotRow
+{
+    Uint64      id;
+    Uint32      generation;
+    SDL_bool    selected;
+    SDL_bool    activate;
+    int         nb_cells;
+    ListUI_Cell cells[LISTUI_MAX_COLUMNS];
+} ListUI_SnapshotRow;
+
+
+/**
+ * A texture cache invalidation, recorded by the thread that mutates the
+ * list and carried out by the thread that renders it.
+ **/
+typedef struct ListUI_Eviction
+{
+    char     *label;
+    SDL_Color color;
+} ListUI_Eviction;
+
+
+/**
+ * Everything that is needed to draw a list. Snapshots are never modified
+ * once published, except for merging with a successor that supersedes them
+ * before they were taken by the renderer.
+ **/
+typedef struct ListUI_Snapshot
+{
+    char               *title;
+    SDL_Color           text_color;
+    SDL_Color           activate_color;
+    SDL_Color           selected_color;
+    SDL_Color           background_color;
+    struct {
+	int          width;
+	ListUI_Align align;
+    } columns[LISTUI_MAX_COLUMNS];
+    int                 nb_columns;
+    ListUI_RenderPath   render_path;
+    ListUI_TextRenderer text_renderer;
+    size_t              cache_budget;
+
+    // Visible rows, followed by rows beyond them in the scroll direction
+    ListUI_SnapshotRow *rows;
+    int                 nb_rows;
+    int                 nb_ahead;
+
+    // Changes that the renderer has to apply before drawing
+    SDL_bool            full;
+    SDL_bool            flush;
+    ListUI_Eviction    *evictions;
+    int                 nb_evictions;
+
+    Uint64              stamp;
+    int                 incomplete; // rows drawn without all of their text
+} ListUI_Snapshot;
+
+
+/**
+ * What was last drawn in a row of the render target.
+ **/
+typedef struct ListUI_RowState
+{
+    Uint64       id;
+    Uint32       generation;
+    Uint32       cells[LISTUI_MAX_COLUMNS];
+    SDL_bool     selected;
+    SDL_bool     complete; // all text was ready when the row was drawn
+} ListUI_RowState;
+
+
+/**
+ * Where drawing operations end up; either the renderer, or the pixels of a
+ * locked streaming texture that cover the given bounds of the output.
+ **/
+typedef struct ListUI_Canvas
+{
+    SDL_Renderer *renderer;
+    TTF_Font     *font;
+    Uint32       *pixels;
+    int           pitch;
+    SDL_Rect      bounds;
+    SDL_bool      atlas; // text is drawn with the glyph atlas
+} ListUI_Canvas;
+
+
+/**
+ * A rasterized label, keyed on (label, color, font). Entries are chained
+ * in a hash bucket, and linked into a LRU list with the most recently used
+ * entry first.
+ **/
+typedef struct ListUI_TextureEntry
+{
+    Uint32       hash;
+    char        *label;
+    SDL_Color    color;
+    TTF_Font    *font;
+    SDL_Texture *texture;
+    int          w;
+    int          h;
+    size_t       size;
+
+    struct ListUI_TextureEntry *chain;
+    struct ListUI_TextureEntry *prev;
+    struct ListUI_TextureEntry *next;
+} ListUI_TextureEntry;
+
+
+typedef struct ListUI_TextureCache
+{
+    SDL_Renderer        *renderer;
+    ListUI_TextureEntry *buckets[LISTUI_CACHE_BUCKETS];
+    ListUI_TextureEntry *first;
+    ListUI_TextureEntry *last;
+    size_t               size;
+    size_t               budget;
+    Uint64               hits;
+    Uint64               misses;
+} ListUI_TextureCache;
 
 
 struct SDL_ListUI
 {
     char        *title;
-    ListUI_Item *first;
-    ListUI_Item *last;
 
     // Rendering settings
     SDL_Color text_color;
     SDL_Color activate_color;
     SDL_Color selected_color;
+    SDL_Color background_color;
+    struct {
+	int          width;
+	ListUI_Align align;
+    } columns[LISTUI_MAX_COLUMNS];
+    int nb_columns;
+
+    // Rendering state. The viewport is given by indices of items, and by
+    // the number of rows that fit the output when it was last laid out.
+    int      top;
+    int      selected;
+    int      nb_visible;
+    SDL_bool dirty;
+    int      scroll_dir;
+    size_t   cache_budget;
+
+    // Storage of items, their cells and text, and the table of item ids.
+    // The arrays of items are kept when the list is cleared.
+    struct {
+	ListUI_Item      *hot;
+	ListUI_Listeners *cold;
+	int               nb;
+	int               max;
+	size_t            high_water;
+    } items;
+    ListUI_Arena cells;
+    ListUI_Arena texts;
+
+    // Rows provided on demand instead of items, and a cache of them
+    struct {
+	ListUI_DataSource callbacks;
+	int               nb_rows;
+	Uint32            generation;
+	ListUI_CachedRow *cache;
+    } source;
+
+    // Items that match the filter query, in list order, and a trigram
+    // index of the column that was last filtered. While the filter is set,
+    // the viewport is given by indices of matches rather than of items.
+    struct {
+	char             *query;  // folded to lower case
+	int               column;
+	ListUI_FilterMode mode;
+	int              *matches;
+	int               nb_matches;
+	int               max_matches;
+	SDL_bool          stale;  // items changed since the query was run
+	int               pin;    // item to keep selected, or -1
+	struct {
+	    ListUI_Posting *postings;
+	    Uint32          size;
+	    Uint32          used;
+	    int             column; // -1 if there is no index
+	    int             built;  // items indexed so far
+	    SDL_bool        stale;
+	} index;
+    } filter;
+    struct {
+	ListUI_Slot *slots;
+	Uint32       nb_slots;
+	Uint32       max_slots;
+	Uint32       epoch;
+	Uint32       free;  // first released slot plus one, or 0
+    } handles;
+
+    // Scratch space of ListUI_Reconcile, kept between calls
+    struct {
+	int    *table;     // positions of items plus one, hashed by key
+	Uint32  size;
+	int    *moves;     // new position of each item, then old position
+	int     max_moves; // of each item at its new position
+    } reconcile;
+
+    // Changes since the last snapshot was published
+    struct {
+	SDL_bool         full;
+	SDL_bool         flush;
+	ListUI_Eviction *evictions;
+	int              nb_evictions;
+	int              max_evictions;
+    } pending;
+
+    // The latest published snapshot, and the one being rendered
+    struct {
+	ListUI_Snapshot *published;
+	ListUI_Snapshot *current;
+	Uint64           stamp;
+    } snapshot;
 
-    // Rendering state
-    ListUI_Item *top;
-    ListUI_Item *selected;
-    ListUI_Item *bottom;
+    // Persistent render target, and the rows drawn into it
+    struct {
+	SDL_Texture      *target;
+	SDL_Renderer     *renderer;
+	TTF_Font         *font;
+	ListUI_RenderPath path;
+	SDL_bool          retained;
+	ListUI_RowState  *rows;
+	ListUI_RowState  *next;
+	int               nb_rows;
+	SDL_bool          full;
+	int               redrawn;
+    } damage;
+    ListUI_RenderPath   render_path;
+    ListUI_TextRenderer text_renderer;
+    ListUI_TextureCache cache;
+    SDL_GlyphAtlas     *atlas;
+    struct {
+	char *dir;
+	char *font_path;
+	int   ptsize;
+    } atlas_cache;
+    SDL_Prefetch *prefetch;
+    int           prefetch_rows;
 
     // Event listeners
     struct {
@@ -59,430 +404,3060 @@ struct SDL_ListUI
 };
 
 
-static ListUI_Item* ListUI_ItemSplit(ListUI_Item* item)
+static Uint32 ListUI_CacheHash(const char* label, SDL_Color c, TTF_Font* font)
 {
-    ListUI_Item *fast = item;
-    ListUI_Item *slow = item;
-    ListUI_Item *ret;
+    Uint32 hash = 2166136261U;
+    Uint64 ptr = (Uint64)font;
 
-    while(fast->next && fast->next->next) {
-	fast = fast->next->next;
-	slow = slow->next;
+    while(*label) {
+	hash = (hash ^ (Uint8)*label++) * 16777619U;
+    }
+    hash = (hash ^ c.r) * 16777619U;
+    hash = (hash ^ c.g) * 16777619U;
+    hash = (hash ^ c.b) * 16777619U;
+    hash = (hash ^ c.a) * 16777619U;
+    for(int i=0; i<8; i++) {
+	hash = (hash ^ (Uint8)(ptr >> (i * 8))) * 16777619U;
     }
 
-    ret = slow->next;
-    slow->next = 0;
+    return hash;
+}
+
 
-    return ret;
+static SDL_bool ListUI_ColorEqual(SDL_Color a, SDL_Color b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
 }
 
 
-static ListUI_Item* ListUI_ItemMerge(ListUI_Item* a, ListUI_Item* b,
-				     ListUI_CompareCallback* cmp)
+static void ListUI_CacheUnlink(ListUI_TextureCache* c, ListUI_TextureEntry* e)
 {
-    if(!a) {
-	return b;
+    if(e->prev) {
+	e->prev->next = e->next;
+    } else {
+	c->first = e->next;
     }
-    if(!b) {
-	return a;
+    if(e->next) {
+	e->next->prev = e->prev;
+    } else {
+	c->last = e->prev;
     }
+    e->prev = e->next = 0;
+}
 
-    if(cmp(a->label, b->label) < 0) {
-	a->next = ListUI_ItemMerge(a->next, b, cmp);
-	a->next->prev = a;
-	a->prev = 0;
-	return a;
+
+static void ListUI_CachePushFront(ListUI_TextureCache* c, ListUI_TextureEntry* e)
+{
+    e->prev = 0;
+    e->next = c->first;
+    if(c->first) {
+	c->first->prev = e;
     } else {
-	b->next = ListUI_ItemMerge(a, b->next, cmp);
-	b->next->prev = b;
-	b->prev = 0;
-	return b;
+	c->last = e;
     }
+    c->first = e;
 }
 
 
-static ListUI_Item* ListUI_ItemMergeSort(ListUI_Item* item,
-					 ListUI_CompareCallback* cmp)
+static void ListUI_CacheEvict(ListUI_TextureCache* c, ListUI_TextureEntry* e)
 {
-    ListUI_Item *other;
+    ListUI_TextureEntry **pp = &c->buckets[e->hash % LISTUI_CACHE_BUCKETS];
 
-    if(!item || !item->next) {
-	return item;
+    while(*pp != e) {
+	pp = &(*pp)->chain;
     }
+    *pp = e->chain;
 
-    other = ListUI_ItemSplit(item);
+    ListUI_CacheUnlink(c, e);
+    c->size -= e->size;
 
-    item  = ListUI_ItemMergeSort(item, cmp);
-    other = ListUI_ItemMergeSort(other, cmp);
-
-    return ListUI_ItemMerge(item, other, cmp);
+    if(e->texture) {
+	SDL_DestroyTexture(e->texture);
+    }
+    SDL_free(e->label);
+    SDL_free(e);
 }
 
 
-int ListUI_DefaultCompareCallback(const char* s1, const char* s2) {
-    int i = SDL_strcasecmp(s1, s2);
-    if(i == 0) {
-	i = SDL_strcmp(s1, s2);
+static void ListUI_CacheFlush(ListUI_TextureCache* c)
+{
+    while(c->first) {
+	ListUI_CacheEvict(c, c->first);
     }
-    return i;
 }
 
 
-void ListUI_Sort(SDL_ListUI* l, ListUI_CompareCallback* cmp)
+/**
+ * Evict all entries with the given label, regardless of color and font.
+ **/
+static void ListUI_CacheEvictLabel(ListUI_TextureCache* c, const char* label)
 {
-    if(!l->first) {
-	return;
-	}
+    ListUI_TextureEntry *next;
 
-    if(!cmp) {
-	cmp = ListUI_DefaultCompareCallback;
+    for(ListUI_TextureEntry *e=c->first; e; e=next) {
+	next = e->next;
+	if(!SDL_strcmp(e->label, label)) {
+	    ListUI_CacheEvict(c, e);
+	}
     }
+}
+
 
-    l->top = l->selected;
-    l->bottom = 0;
-    l->first = l->last = ListUI_ItemMergeSort(l->first, cmp);
+/**
+ * Evict all entries with the given color, regardless of label and font.
+ **/
+static void ListUI_CacheEvictColor(ListUI_TextureCache* c, SDL_Color color)
+{
+    ListUI_TextureEntry *next;
 
-    while(l->last->next) {
-	l->last = l->last->next;
+    for(ListUI_TextureEntry *e=c->first; e; e=next) {
+	next = e->next;
+	if(ListUI_ColorEqual(e->color, color)) {
+	    ListUI_CacheEvict(c, e);
+	}
     }
 }
 
 
-SDL_ListUI* ListUI_Create(const char* title)
+/**
+ * Lookup a rasterized label without rasterizing it on a cache miss.
+ **/
+static ListUI_TextureEntry* ListUI_CacheLookup(ListUI_TextureCache* c,
+					       SDL_Renderer* renderer,
+					       const char* label,
+					       TTF_Font* font, SDL_Color color)
 {
-    SDL_ListUI* l = SDL_calloc(1, sizeof(SDL_ListUI));
-
-    l->text_color.r = 240;
-    l->text_color.g = 240;
-    l->text_color.b = 240;
-    l->text_color.a = 120;
-
-    l->activate_color.r = 240;
-    l->activate_color.g = 240;
-    l->activate_color.b = 240;
-    l->activate_color.a = 255;
+    Uint32 hash = ListUI_CacheHash(label, color, font);
+    ListUI_TextureEntry *e;
 
-    l->selected_color.r = 120;
-    l->selected_color.g = 120;
-    l->selected_color.b = 0;
-    l->selected_color.a = 255;
+    // Textures belong to a specific renderer
+    if(c->renderer != renderer) {
+	ListUI_CacheFlush(c);
+	c->renderer = renderer;
+    }
 
-    ListUI_SetTitle(l, title);
+    for(e=c->buckets[hash % LISTUI_CACHE_BUCKETS]; e; e=e->chain) {
+	if(e->hash == hash && e->font == font &&
+	   ListUI_ColorEqual(e->color, color) && !SDL_strcmp(e->label, label)) {
+	    ListUI_CacheUnlink(c, e);
+	    ListUI_CachePushFront(c, e);
+	    return e;
+	}
+    }
 
-    return l;
+    return 0;
 }
 
 
-void ListUI_Clear(SDL_ListUI* l)
+/**
+ * Upload a rasterized label to the cache. A NULL surface inserts an entry
+ * without texture, so that labels that fail to rasterize are not retried.
+ * Least recently used entries are evicted until the cache fits within its
+ * budget again.
+ **/
+static ListUI_TextureEntry* ListUI_CacheInsert(ListUI_TextureCache* c,
+					       SDL_Renderer* renderer,
+					       const char* label,
+					       TTF_Font* font, SDL_Color color,
+					       SDL_Surface* surface)
 {
-    ListUI_Item *next;
+    Uint32 hash = ListUI_CacheHash(label, color, font);
+    ListUI_TextureEntry **bucket = &c->buckets[hash % LISTUI_CACHE_BUCKETS];
+    ListUI_TextureEntry *e = SDL_calloc(1, sizeof(ListUI_TextureEntry));
+
+    if(!e) {
+	return 0;
+    }
+    if(!(e->label=SDL_strdup(label))) {
+	SDL_free(e);
+	return 0;
+    }
+
+    e->hash = hash;
+    e->color = color;
+    e->font = font;
+    if(surface) {
+	e->texture = SDL_CreateTextureFromSurface(renderer, surface);
+	e->w = surface->w;
+	e->h = surface->h;
+	e->size = (size_t)surface->w * surface->h * 4;
+
+	if(!e->texture) {
+	    SDL_free(e->label);
+	    SDL_free(e);
+	    return 0;
+	}
+    }
+
+    e->chain = *bucket;
+    *bucket = e;
+    ListUI_CachePushFront(c, e);
+    c->size += e->size;
 
-    while(l->first) {
-	next = l->first->next;
-	SDL_free(l->first->label);
-	SDL_free(l->first);
-	l->first = next;
+    while(c->size > c->budget && c->last != e) {
+	ListUI_CacheEvict(c, c->last);
     }
-    l->top = l->selected = l->bottom = 0;
+
+    return e;
 }
 
 
-void ListUI_Destroy(SDL_ListUI* l)
+/**
+ * Lookup a rasterized label, and rasterize it on a cache miss.
+ **/
+static ListUI_TextureEntry* ListUI_CacheGet(ListUI_TextureCache* c,
+					    SDL_Renderer* renderer,
+					    const char* label, TTF_Font* font,
+					    SDL_Color color)
 {
+    ListUI_TextureEntry *e;
+    SDL_Surface *surface;
 
-    if(l->on_destroy.fn) {
-	l->on_destroy.fn(l->on_destroy.ctx, l);
+    if((e=ListUI_CacheLookup(c, renderer, label, font, color))) {
+	c->hits++;
+	return e;
     }
 
-    ListUI_Clear(l);
-    SDL_free(l->title);
-    SDL_free(l);
+    c->misses++;
+    if(!(surface=TTF_RenderUTF8_Solid(font, label, color))) {
+	return 0;
+    }
+
+    e = ListUI_CacheInsert(c, renderer, label, font, color, surface);
+    SDL_FreeSurface(surface);
+
+    return e;
 }
 
 
-void ListUI_OnDestroy(SDL_ListUI* l, ListUI_OnDestroyCallback* fn, void* ctx)
+/**
+ * Return the text of an item that filters apply to.
+ **/
+static const char* ListUI_GetFilterText(SDL_ListUI* l, int item, int column)
 {
-    l->on_destroy.fn = fn;
-    l->on_destroy.ctx = ctx;
+    ListUI_Item* it = &l->items.hot[item];
+
+    return column < it->nb_cells ? it->cells[column].text : "";
 }
 
 
-void ListUI_SetTitle(SDL_ListUI* l, const char* title)
+/**
+ * Return SDL_TRUE if text contains a query that is folded to lower case, or
+ * starts with it, ignoring case.
+ **/
+static SDL_bool ListUI_MatchText(const char* text, const char* query,
+				 ListUI_FilterMode mode)
 {
-    if(!title) {
-	title = "";
-    }
-    if(l->title) {
-	SDL_free(l->title);
+    char upper = (char)SDL_toupper((unsigned char)*query);
+    int i;
+
+    // Candidate positions are found without folding the text
+    for(const char* s=text; ; s++) {
+	if(*s == *query || *s == upper) {
+	    for(i=1; query[i]; i++) {
+		if(SDL_tolower((unsigned char)s[i]) != (unsigned char)query[i]) {
+		    break;
+		}
+	    }
+	    if(!query[i]) {
+		return SDL_TRUE;
+	    }
+	}
+	if(!*s || mode == LISTUI_FILTER_PREFIX) {
+	    return SDL_FALSE;
+	}
     }
-    l->title = SDL_strdup(title);
 }
 
 
-void ListUI_SetTextColor(SDL_ListUI* l, SDL_Color c)
+/**
+ * Pack the trigram of text that ends at the given position, folded to lower
+ * case. Positions before the start of the text are padding, so that the
+ * first two trigrams of text identify its prefix.
+ **/
+static Uint32 ListUI_Gram(const char* text, int end)
 {
-    l->text_color = c;
+    Uint32 gram = 0;
+
+    for(int i=end-2; i<=end; i++) {
+	gram <<= 8;
+	gram |= i < 0 ? LISTUI_GRAM_START :
+	    (Uint8)SDL_tolower((unsigned char)text[i]);
+    }
+
+    return gram;
 }
 
 
-void ListUI_SetSelectedColor(SDL_ListUI* l, SDL_Color c)
+/**
+ * Find the posting list of a trigram, optionally adding an empty one if
+ * there is none. Returns NULL if there is no such list.
+ **/
+static ListUI_Posting* ListUI_GetPosting(SDL_ListUI* l, Uint32 gram,
+					 SDL_bool create)
 {
-    l->selected_color = c;
+    ListUI_Posting* postings;
+    Uint32 size = l->filter.index.size;
+    Uint32 i;
+
+    if(create && 2 * (l->filter.index.used + 1) > size) {
+	size = SDL_max(1024, size * 2);
+	if(!(postings=SDL_calloc(size, sizeof(ListUI_Posting)))) {
+	    return 0;
+	}
+	for(Uint32 j=0; j<l->filter.index.size; j++) {
+	    if(!l->filter.index.postings[j].gram) {
+		continue;
+	    }
+	    i = l->filter.index.postings[j].gram * 2654435761U;
+	    while(postings[i & (size - 1)].gram) {
+		i++;
+	    }
+	    postings[i & (size - 1)] = l->filter.index.postings[j];
+	}
+	SDL_free(l->filter.index.postings);
+	l->filter.index.postings = postings;
+	l->filter.index.size = size;
+    }
+
+    if(!size) {
+	return 0;
+    }
+
+    for(i=gram * 2654435761U; l->filter.index.postings[i & (size - 1)].gram;
+	i++) {
+	if(l->filter.index.postings[i & (size - 1)].gram == gram) {
+	    return &l->filter.index.postings[i & (size - 1)];
+	}
+    }
+    if(!create) {
+	return 0;
+    }
+
+    l->filter.index.used++;
+    l->filter.index.postings[i & (size - 1)].gram = gram;
+
+    return &l->filter.index.postings[i & (size - 1)];
 }
 
 
-void ListUI_SetActivateTextColor(SDL_ListUI* l, SDL_Color c)
+/**
+ * Add the trigrams in the indexed column of an item to the index. Items
+ * are indexed in ascending order, which keeps posting lists sorted.
+ **/
+static int ListUI_IndexItem(SDL_ListUI* l, int item)
 {
-    l->activate_color = c;
+    const char* text = ListUI_GetFilterText(l, item, l->filter.index.column);
+    ListUI_Posting* p;
+    int* items;
+    int max;
+
+    for(int end=0; text[end]; end++) {
+	if(!(p=ListUI_GetPosting(l, ListUI_Gram(text, end), SDL_TRUE))) {
+	    return -1;
+	}
+	if(p->nb && p->items[p->nb - 1] == item) {
+	    continue;
+	}
+	if(p->nb == p->max) {
+	    max = SDL_max(4, p->max * 2);
+	    if(!(items=SDL_realloc(p->items, max * sizeof(int)))) {
+		return -1;
+	    }
+	    p->items = items;
+	    p->max = max;
+	}
+	p->items[p->nb++] = item;
+    }
+
+    return 0;
 }
 
 
-Uint64 ListUI_AppendItem(SDL_ListUI* l, const char* label)
+/**
+ * Index the text in the filtered column of up to the given number of items
+ * that are not indexed yet, so that building the index is spread over
+ * several frames, and return SDL_TRUE once all items are indexed. Posting
+ * lists are emptied rather than freed when the index is rebuilt.
+ **/
+static SDL_bool ListUI_UpdateIndex(SDL_ListUI* l, int budget)
 {
-    ListUI_Item* item = SDL_calloc(1, sizeof(ListUI_Item));
-
-    if(!label) {
-	label = "";
+    if(l->filter.index.column != l->filter.column || l->filter.index.stale) {
+	for(Uint32 i=0; i<l->filter.index.size; i++) {
+	    l->filter.index.postings[i].nb = 0;
+	}
+	l->filter.index.column = l->filter.column;
+	l->filter.index.built = 0;
+	l->filter.index.stale = SDL_FALSE;
     }
-    item->label = SDL_strdup(label);
 
-    if(!l->first) {
-	l->first = l->last = item;
-    } else {
-	item->prev = l->last;
-	l->last->next = item;
-	l->last = item;
+    for(; l->filter.index.built < l->items.nb && budget > 0; budget--) {
+	if(ListUI_IndexItem(l, l->filter.index.built)) {
+	    l->filter.index.stale = SDL_TRUE;
+	    return SDL_FALSE;
+	}
+	l->filter.index.built++;
     }
 
-    return (Uint64)item;
+    return l->filter.index.built == l->items.nb;
 }
 
 
-static ListUI_Item* ListUI_GetItem(SDL_ListUI* l, Uint64 id)
+/**
+ * Return the posting list with the fewest items among those of the trigrams
+ * in the query, or NULL if the query is too short, or the index is not ready
+ * yet. Every item that matches the query is in the list.
+ **/
+static ListUI_Posting* ListUI_GetCandidates(SDL_ListUI* l)
 {
-    for(ListUI_Item* it=l->first; it!=0; it=it->next) {
-	if(id == (Uint64)it) {
-	    return it;
+    static ListUI_Posting empty;
+    const char* query = l->filter.query;
+    int first = l->filter.mode == LISTUI_FILTER_PREFIX ? 0 : 2;
+    ListUI_Posting* best = 0;
+    ListUI_Posting* p;
+
+    if(SDL_strlen(query) <= first || !ListUI_UpdateIndex(l, 0)) {
+	return 0;
+    }
+
+    for(int end=first; query[end]; end++) {
+	if(!(p=ListUI_GetPosting(l, ListUI_Gram(query, end), SDL_FALSE)) ||
+	   !p->nb) {
+	    return &empty;
+	}
+	if(!best || p->nb < best->nb) {
+	    best = p;
 	}
     }
-    return 0;
+
+    return best;
 }
 
 
-SDL_bool ListUI_SetItemLabel(SDL_ListUI* l, Uint64 id, const char* label)
+/**
+ * Clear the filter, and keep the selected item selected.
+ **/
+static void ListUI_ClearFilter(SDL_ListUI* l, int item)
+{
+    int row = l->selected - l->top;
+
+    SDL_free(l->filter.query);
+    l->filter.query = 0;
+    l->filter.nb_matches = 0;
+    l->filter.stale = SDL_FALSE;
+    l->filter.pin = -1;
+
+    l->selected = SDL_max(0, item);
+    l->top = SDL_max(0, SDL_min(l->selected - row,
+				l->items.nb - l->nb_visible));
+    l->dirty = SDL_TRUE;
+}
+
+
+/**
+ * Find the items that match the filter query, only considering those that
+ * matched before if the query was refined, and keep the selected item, or
+ * the next one that matches, selected. Returns the number of matching
+ * items, or -1 if there is not enough memory, in which case the filter is
+ * cleared.
+ **/
+static int ListUI_RunFilter(SDL_ListUI* l, SDL_bool refine)
 {
-    ListUI_Item* it = ListUI_GetItem(l, id);
+    const char* query = l->filter.query;
+    int row = l->selected - l->top;
+    int item = l->filter.pin;
+    ListUI_Posting* candidates;
+    int* matches;
+    int n = 0;
+    int lo, hi;
 
-    if(it) {
-	if(it->label) {
-	    SDL_free(it->label);
+    if(item < 0) {
+	item = l->selected < l->filter.nb_matches ?
+	    l->filter.matches[l->selected] : 0;
+    }
+
+    if(l->filter.max_matches < l->items.nb) {
+	if(!(matches=SDL_realloc(l->filter.matches, l->items.nb * sizeof(int)))) {
+	    ListUI_ClearFilter(l, item);
+	    return -1;
+	}
+	l->filter.matches = matches;
+	l->filter.max_matches = l->items.nb;
+    }
+    matches = l->filter.matches;
+
+    if(refine) {
+	for(int i=0; i<l->filter.nb_matches; i++) {
+	    if(ListUI_MatchText(ListUI_GetFilterText(l, matches[i],
+						     l->filter.column),
+				query, l->filter.mode)) {
+		matches[n++] = matches[i];
+	    }
+	}
+    } else if((candidates=ListUI_GetCandidates(l))) {
+	for(int i=0; i<candidates->nb; i++) {
+	    if(ListUI_MatchText(ListUI_GetFilterText(l, candidates->items[i],
+						     l->filter.column),
+				query, l->filter.mode)) {
+		matches[n++] = candidates->items[i];
+	    }
+	}
+    } else {
+	for(int i=0; i<l->items.nb; i++) {
+	    if(ListUI_MatchText(ListUI_GetFilterText(l, i, l->filter.column),
+				query, l->filter.mode)) {
+		matches[n++] = i;
+	    }
 	}
-	it->label = SDL_strdup(label);
-	return SDL_TRUE;
     }
 
-    return SDL_FALSE;
+    // Matches are in list order, so the selection is found by bisection
+    lo = 0;
+    hi = n;
+    while(lo < hi) {
+	if(matches[(lo + hi) / 2] < item) {
+	    lo = (lo + hi) / 2 + 1;
+	} else {
+	    hi = (lo + hi) / 2;
+	}
+    }
+
+    l->filter.nb_matches = n;
+    l->filter.stale = SDL_FALSE;
+    l->filter.pin = -1;
+    l->selected = SDL_max(0, SDL_min(lo, n - 1));
+    l->top = SDL_max(0, SDL_min(l->selected - row, n - l->nb_visible));
+    l->dirty = SDL_TRUE;
+
+    return n;
 }
 
 
-SDL_bool ListUI_OnSelect(SDL_ListUI* l, Uint64 id,
-			 ListUI_OnSelectCallback* fn, void* ctx)
+/**
+ * Return the number of rows in the list, i.e., items that match the filter,
+ * or rows of the data source if there is one.
+ **/
+static int ListUI_GetCount(SDL_ListUI* l)
 {
-    ListUI_Item* it = ListUI_GetItem(l, id);
-
-    if(it) {
-	it->on_select.fn = fn;
-	it->on_select.ctx = ctx;
-	return SDL_TRUE;
+    if(l->source.callbacks.row) {
+	return l->source.nb_rows;
+    }
+    if(l->filter.query && l->filter.stale) {
+	ListUI_RunFilter(l, SDL_FALSE);
     }
 
-    return SDL_FALSE;
+    return l->filter.query ? l->filter.nb_matches : l->items.nb;
 }
 
 
-SDL_bool ListUI_OnActivate(SDL_ListUI* l, Uint64 id,
-			   ListUI_OnActivateCallback* fn, void* ctx)
+/**
+ * Return the position in the list of the item shown in the given row.
+ **/
+static int ListUI_RowToItem(SDL_ListUI* l, int row)
 {
-    ListUI_Item* it = ListUI_GetItem(l, id);
+    return l->filter.query ? l->filter.matches[row] : row;
+}
 
-    if(it) {
-	it->on_activate.fn = fn;
-	it->on_activate.ctx = ctx;
-	return SDL_TRUE;
+
+/**
+ * Return the position in the list of the selected item, or -1 if no item
+ * is selected.
+ **/
+static int ListUI_GetSelectedItem(SDL_ListUI* l)
+{
+    if(l->selected >= ListUI_GetCount(l)) {
+	return -1;
     }
 
-    return SDL_FALSE;
+    return ListUI_RowToItem(l, l->selected);
 }
 
 
-void ListUI_NavigateItemUp(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+/**
+ * Take note of items that moved, so that the index is rebuilt, and the
+ * filter applied again with the given item selected.
+ **/
+static void ListUI_FilterMoved(SDL_ListUI* l, int item)
 {
-    if(!l->selected || !l->selected->prev) {
-	if(wraparound) {
-	    l->bottom = l->selected = l->last;
-	    l->top = 0;
-	}
-    } else {
-	l->selected = l->selected->prev;
-	if(l->selected == l->top && l->top->prev) {
-	    l->top = l->top->prev;
-	    l->bottom = l->bottom->prev;
-	}
+    l->filter.index.stale = SDL_TRUE;
+    if(l->filter.query) {
+	l->filter.stale = SDL_TRUE;
+	l->filter.pin = item;
     }
+}
 
-    if(l->selected && l->selected->on_select.fn && !silent) {
-	l->selected->on_select.fn(l->selected->on_select.ctx, l,
-				  (Uint64)l->selected);
+
+/**
+ * Take note of text that changed in the given column of an item.
+ **/
+static void ListUI_FilterChanged(SDL_ListUI* l, int column)
+{
+    if(column == l->filter.index.column) {
+	l->filter.index.stale = SDL_TRUE;
+    }
+    if(l->filter.query && column == l->filter.column) {
+	l->filter.stale = SDL_TRUE;
     }
 }
 
 
-void ListUI_NavigateItemDown(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+/**
+ * Add an item that was appended to the index, and to the matches of the
+ * filter if it matches the query.
+ **/
+static void ListUI_FilterAppended(SDL_ListUI* l, int item)
 {
-    if(!l->selected || !l->selected->next) {
-	if(wraparound) {
-	    l->top = l->selected = l->first;
-	    l->bottom = 0;
-	}
-    } else {
-	l->selected = l->selected->next;
-	if(l->selected == l->bottom && l->bottom->next) {
-	    l->bottom = l->bottom->next;
-	    l->top = l->top->next;
+    if(l->filter.index.column >= 0 && !l->filter.index.stale &&
+       l->filter.index.built == item) {
+	if(ListUI_IndexItem(l, item)) {
+	    l->filter.index.stale = SDL_TRUE;
+	} else {
+	    l->filter.index.built++;
 	}
     }
 
-    if(l->selected && l->selected->on_select.fn && !silent) {
-	l->selected->on_select.fn(l->selected->on_select.ctx, l,
-				  (Uint64)l->selected);
+    if(!l->filter.query || l->filter.stale) {
+	return;
+    }
+    if(l->filter.nb_matches == l->filter.max_matches) {
+	l->filter.stale = SDL_TRUE;
+    } else if(ListUI_MatchText(ListUI_GetFilterText(l, item, l->filter.column),
+			       l->filter.query, l->filter.mode)) {
+	l->filter.matches[l->filter.nb_matches++] = item;
     }
 }
 
 
-void ListUI_NavigatePageUp(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+int ListUI_SetFilter(SDL_ListUI* l, const char* query, int column,
+		     ListUI_FilterMode mode)
 {
-    int n = 0;
+    SDL_bool refine;
+    char* folded;
+    int item;
+
+    if(l->source.callbacks.row || column < 0 || column >= LISTUI_MAX_COLUMNS) {
+	return -1;
+    }
 
-    for(ListUI_Item* it=l->top; it && it!=l->bottom; it=it->next) {
-	n++;
+    item = ListUI_GetSelectedItem(l);
+    if(!query || !*query) {
+	if(l->filter.query) {
+	    ListUI_ClearFilter(l, item);
+	}
+	return l->items.nb;
     }
-    for(int i=0; i<n-1; i++) {
-	ListUI_NavigateItemUp(l, SDL_TRUE, wraparound);
+
+    if(!(folded=SDL_strdup(query))) {
+	return -1;
     }
-    if(n) {
-	ListUI_NavigateItemUp(l, silent, wraparound);
+    for(char* s=folded; *s; s++) {
+	*s = (char)SDL_tolower((unsigned char)*s);
     }
+
+    // A query that extends the previous one can only match fewer items
+    refine = l->filter.query && !l->filter.stale &&
+	l->filter.column == column && l->filter.mode == mode &&
+	!SDL_strncmp(folded, l->filter.query, SDL_strlen(l->filter.query));
+
+    SDL_free(l->filter.query);
+    l->filter.query = folded;
+    l->filter.column = column;
+    l->filter.mode = mode;
+    l->filter.pin = SDL_max(0, item);
+
+    return ListUI_RunFilter(l, refine);
 }
 
 
-void ListUI_NavigatePageDown(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+/**
+ * An item being sorted, with a key that is computed once per item. Keys are
+ * either numeric, or a case-folded copy of the label whose leading bytes are
+ * packed into the numeric key, so that most comparisons never touch text.
+ **/
+typedef struct ListUI_SortEntry
 {
-    int n = 0;
+    Uint64      prefix;
+    const char *key;
+    const char *label;
+    int         index;
+} ListUI_SortEntry;
 
-    for(ListUI_Item* it=l->top; it && it!=l->bottom; it=it->next) {
-	n++;
+
+static int ListUI_CompareEntries(const ListUI_SortEntry* a,
+				 const ListUI_SortEntry* b,
+				 ListUI_CompareCallback* cmp)
+{
+    int i;
+
+    if(cmp) {
+	return cmp(a->label, b->label);
+    }
+    if(a->prefix != b->prefix) {
+	return a->prefix < b->prefix ? -1 : 1;
     }
-    for(int i=0; i<n-1; i++) {
-	ListUI_NavigateItemDown(l, SDL_TRUE, wraparound);
+
+    // Text keys with the same prefix only differ past it if they are longer
+    if(!a->key || !(a->prefix & 0xff)) {
+	i = 0;
+    } else {
+	i = SDL_strcmp(a->key + sizeof(Uint64), b->key + sizeof(Uint64));
     }
-    if(n) {
-	ListUI_NavigateItemDown(l, silent, wraparound);
+    if(!i && a->key) {
+	i = SDL_strcmp(a->label, b->label);
     }
+
+    return i;
 }
 
 
-void ListUI_ActivateSelected(SDL_ListUI* l)
+/**
+ * Sort entries with a stable bottom-up merge sort, using tmp as scratch
+ * space, and return the array that holds the sorted entries.
+ **/
+static ListUI_SortEntry* ListUI_MergeSort(ListUI_SortEntry* entries,
+					  ListUI_SortEntry* tmp, int n,
+					  ListUI_CompareCallback* cmp)
 {
-    if(!l->selected || !l->selected->on_activate.fn) {
-	return;
+    ListUI_SortEntry* src = entries;
+    ListUI_SortEntry* dst = tmp;
+    ListUI_SortEntry* swap;
+    int mid, end, i, j, k;
+
+    for(int width=1; width<n; width*=2) {
+	for(int start=0; start<n; start+=2*width) {
+	    mid = SDL_min(start + width, n);
+	    end = SDL_min(start + 2*width, n);
+	    i = start;
+	    j = mid;
+	    k = start;
+
+	    while(i < mid && j < end) {
+		if(ListUI_CompareEntries(&src[j], &src[i], cmp) < 0) {
+		    dst[k++] = src[j++];
+		} else {
+		    dst[k++] = src[i++];
+		}
+	    }
+	    while(i < mid) {
+		dst[k++] = src[i++];
+	    }
+	    while(j < end) {
+		dst[k++] = src[j++];
+	    }
+	}
+	swap = src;
+	src = dst;
+	dst = swap;
     }
 
-    l->selected->on_activate.fn(l->selected->on_activate.ctx, l,
-				(Uint64)l->selected);
+    return src;
 }
 
 
-static void ListUI_RenderText(SDL_Renderer* renderer, const char* text,
-			      TTF_Font* font, int x, int y, SDL_Color color)
+/**
+ * Fold the labels of all items to lower case, like SDL_strcasecmp does,
+ * into a single buffer, and key the entries with them.
+ **/
+static char* ListUI_FoldLabels(SDL_ListUI* l, ListUI_SortEntry* entries)
 {
-    SDL_Surface* surface = TTF_RenderText_Solid(font, text, color);
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_Rect rect = {x, y, surface->w, surface->h};
+    size_t size = 0;
+    char* keys;
+    char* key;
 
-    SDL_RenderCopy(renderer, texture, NULL, &rect);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+    for(int i=0; i<l->items.nb; i++) {
+	size += SDL_strlen(l->items.hot[i].label) + 1;
+    }
+    if(!(keys=SDL_malloc(size))) {
+	return 0;
+    }
+
+    key = keys;
+    for(int i=0; i<l->items.nb; i++) {
+	entries[i].key = key;
+	entries[i].prefix = 0;
+	for(const char* s=l->items.hot[i].label; ; s++, key++) {
+	    *key = (char)SDL_tolower((unsigned char)*s);
+	    if(key - entries[i].key < (int)sizeof(Uint64)) {
+		entries[i].prefix |= (Uint64)(Uint8)*key <<
+		    (8 * (sizeof(Uint64) - 1 - (key - entries[i].key)));
+	    }
+	    if(!*s) {
+		key++;
+		break;
+	    }
+	}
+    }
+
+    return keys;
 }
 
 
-void ListUI_Render(SDL_ListUI* l, SDL_Renderer* renderer, TTF_Font* font)
+/**
+ * Move items to the positions given by sorted entries, and keep the selected
+ * item selected, in the same row of the view while possible.
+ **/
+static void ListUI_Reorder(SDL_ListUI* l, const ListUI_SortEntry* entries)
 {
-    int item_height = (int)TTF_FontHeight(font);
-    int padding = item_height / 4;
-    ListUI_Item* it;
-    SDL_Color color;
-    SDL_Rect rect;
-    int x = 0;
-    int y = 0;
-    int w, h;
-
-    if(SDL_GetRendererOutputSize(renderer, &w, &h)) {
+    int n = l->items.nb;
+    int row = l->selected - l->top;
+    int selected = ListUI_GetSelectedItem(l);
+    int moved = -1;
+    ListUI_Listeners* cold;
+    ListUI_Item* hot;
+
+    // Items are left in place if there is no memory to move them
+    hot = SDL_malloc(l->items.max * sizeof(ListUI_Item));
+    cold = SDL_malloc(l->items.max * sizeof(ListUI_Listeners));
+    if(!hot || !cold) {
+	SDL_free(hot);
+	SDL_free(cold);
 	return;
     }
 
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    for(int i=0; i<n; i++) {
+	hot[i] = l->items.hot[entries[i].index];
+	cold[i] = l->items.cold[entries[i].index];
+	l->handles.slots[(Uint32)hot[i].id].index = i;
+	if(moved < 0 && entries[i].index == selected) {
+	    moved = i;
+	}
+    }
 
-    // Render title
-    y += padding;
-    ListUI_RenderText(renderer, l->title, font, x+padding, y, l->activate_color);
-    y += item_height;
+    SDL_free(l->items.hot);
+    SDL_free(l->items.cold);
+    l->items.hot = hot;
+    l->items.cold = cold;
 
-    // Render horizontal line
-    rect.x = x;
-    rect.y = y;
-    rect.w = w;
-    rect.h = padding / 4;
-    SDL_SetRenderDrawColor(renderer, l->activate_color.r, l->activate_color.g,
-			   l->activate_color.b, l->activate_color.a);
-    SDL_RenderFillRect(renderer, &rect);
-    y += padding;
-
-    if(!l->selected) {
-	l->selected = l->top = l->first;
-    }
-
-    // Cursor moved from top to bottom, figure out how many items we can fit
-    if(!l->top && l->bottom) {
-	l->top = l->bottom;
-	for(int i=y; i < h-item_height-padding && l->top->prev; i+=item_height) {
-	    l->top = l->top->prev;
-	}
-    }
-
-    // Render list of items
-    it = l->top;
-    while(y < h-item_height && it) {
-	if(it == l->selected) {
-	    rect.x = x;
-	    rect.y = y;
-	    rect.w = w;
-	    rect.h = TTF_FontHeight(font);
-	    SDL_SetRenderDrawColor(renderer,
-				   l->selected_color.r, l->selected_color.g,
-				   l->selected_color.b, l->selected_color.a);
-	    SDL_RenderFillRect(renderer, &rect);
-	}
-	if (it->on_activate.fn) {
-	    color = l->activate_color;
-	} else {
-	    color = l->text_color;
-	}
+    // The filter finds the selected item among the matches later on
+    ListUI_FilterMoved(l, moved);
+    if(!l->filter.query) {
+	l->selected = SDL_max(0, moved);
+	l->top = SDL_max(0, SDL_min(l->selected - row, n - l->nb_visible));
+    }
+    l->dirty = SDL_TRUE;
+}
 
-	ListUI_RenderText(renderer, it->label, font, x+padding, y, color);
 
-	l->bottom = it;
-	it = it->next;
-	y += item_height;
+/**
+ * Sort the items, either by keys given by a callback, or by labels, using
+ * precomputed case-folded keys unless a comparison callback is given.
+ **/
+static void ListUI_SortItems(SDL_ListUI* l, ListUI_CompareCallback* cmp,
+			     ListUI_SortKeyCallback* fn, void* ctx)
+{
+    int n = l->items.nb;
+    ListUI_SortEntry* entries;
+    ListUI_SortEntry* sorted;
+    char* keys = 0;
+
+    if(!n || l->source.callbacks.row) {
+	return;
+    }
+    if(cmp == ListUI_DefaultCompareCallback) {
+	cmp = 0;
+    }
+
+    if(!(entries=SDL_malloc(2 * n * sizeof(ListUI_SortEntry)))) {
+	return;
+    }
+    for(int i=0; i<n; i++) {
+	entries[i].prefix = fn ? fn(ctx, l, l->items.hot[i].id) : 0;
+	entries[i].key = 0;
+	entries[i].label = l->items.hot[i].label;
+	entries[i].index = i;
+    }
+    if(!fn && !cmp && !(keys=ListUI_FoldLabels(l, entries))) {
+	SDL_free(entries);
+	return;
+    }
+
+    sorted = ListUI_MergeSort(entries, entries + n, n, cmp);
+    ListUI_Reorder(l, sorted);
+
+    SDL_free(entries);
+    SDL_free(keys);
+}
+
+
+int ListUI_DefaultCompareCallback(const char* s1, const char* s2) {
+    int i = SDL_strcasecmp(s1, s2);
+    if(i == 0) {
+	i = SDL_strcmp(s1, s2);
+    }
+    return i;
+}
+
+
+void ListUI_Sort(SDL_ListUI* l, ListUI_CompareCallback* cmp)
+{
+    ListUI_SortItems(l, cmp, 0, 0);
+}
+
+
+void ListUI_SortByKey(SDL_ListUI* l, ListUI_SortKeyCallback* fn, void* ctx)
+{
+    ListUI_SortItems(l, 0, fn, ctx);
+}
+
+
+static void* ListUI_ArenaAlloc(ListUI_Arena* a, size_t size, size_t align)
+{
+    ListUI_Chunk* chunk;
+    size_t offset;
+    size_t capacity;
+
+    while(a->current) {
+	offset = (a->current->used + align - 1) & ~(align - 1);
+	if(offset + size <= a->current->size) {
+	    a->current->used = offset + size;
+	    a->used += size;
+	    a->high_water = SDL_max(a->high_water, a->used);
+	    return a->current->data + offset;
+	}
+
+	// Chunks past the current one are left over from before a reset
+	if(!a->current->next) {
+	    break;
+	}
+	a->current = a->current->next;
+	a->current->used = 0;
+    }
+
+    capacity = SDL_max(size + align, LISTUI_ARENA_CHUNK);
+    if(!(chunk=SDL_malloc(sizeof(ListUI_Chunk) + capacity))) {
+	return 0;
+    }
+    chunk->next = 0;
+    chunk->size = capacity;
+    chunk->used = 0;
+    if(a->current) {
+	a->current->next = chunk;
+    } else {
+	a->first = chunk;
+    }
+    a->current = chunk;
+    a->reserved += capacity;
+
+    return ListUI_ArenaAlloc(a, size, align);
+}
+
+
+static void ListUI_ArenaReset(ListUI_Arena* a)
+{
+    a->current = a->first;
+    if(a->current) {
+	a->current->used = 0;
+    }
+    a->used = 0;
+    a->wasted = 0;
+}
+
+
+static void ListUI_ArenaFree(ListUI_Arena* a)
+{
+    ListUI_Chunk* next;
+
+    for(ListUI_Chunk* chunk=a->first; chunk; chunk=next) {
+	next = chunk->next;
+	SDL_free(chunk);
+    }
+    SDL_memset(a, 0, sizeof(ListUI_Arena));
+}
+
+
+/**
+ * Point a cell at a copy of the given text, stored inline if it is short
+ * enough, and otherwise in the given arena, or on the heap if there is no
+ * arena.
+ **/
+static void ListUI_CopyText(ListUI_Cell* cell, const char* text,
+			    ListUI_Arena* arena)
+{
+    size_t size = SDL_strlen(text) + 1;
+
+    if(size <= sizeof(cell->inline_text)) {
+	cell->text = cell->inline_text;
+    } else if(arena) {
+	cell->text = ListUI_ArenaAlloc(arena, size, 1);
+    } else {
+	cell->text = SDL_malloc(size);
+    }
+
+    if(!cell->text) {
+	cell->text = cell->inline_text;
+	*cell->text = 0;
+	return;
+    }
+    SDL_memcpy(cell->text, text, size);
+}
+
+
+/**
+ * Bind the item at the given index to a released slot in the id table, or
+ * to the next one, and return its id, or 0 if the table cannot grow.
+ **/
+static Uint64 ListUI_AcquireSlot(SDL_ListUI* l, int index)
+{
+    ListUI_Slot* slots;
+    Uint32 slot;
+    Uint32 max;
+
+    if(l->handles.free) {
+	slot = l->handles.free - 1;
+	l->handles.free = l->handles.slots[slot].index;
+	if(!++l->handles.epoch) {
+	    l->handles.epoch++;
+	}
+    } else if(l->handles.nb_slots < l->handles.max_slots) {
+	slot = l->handles.nb_slots++;
+    } else {
+	max = SDL_max(64, l->handles.max_slots * 2);
+	if(!(slots=SDL_realloc(l->handles.slots, max * sizeof(ListUI_Slot)))) {
+	    return 0;
+	}
+	l->handles.slots = slots;
+	l->handles.max_slots = max;
+	slot = l->handles.nb_slots++;
+    }
+
+    l->handles.slots[slot].index = index;
+    l->handles.slots[slot].generation = l->handles.epoch;
+
+    return ((Uint64)l->handles.epoch << LISTUI_SLOT_BITS) | slot;
+}
+
+
+/**
+ * Release the slot, the cells and the text of an item that was removed.
+ **/
+static void ListUI_ReleaseItem(SDL_ListUI* l, ListUI_Item* it)
+{
+    Uint32 slot = (Uint32)it->id;
+
+    l->handles.slots[slot].generation = 0;
+    l->handles.slots[slot].index = l->handles.free;
+    l->handles.free = slot + 1;
+
+    l->cells.wasted += it->max_cells * sizeof(ListUI_Cell);
+    for(int i=0; i<it->nb_cells; i++) {
+	if(it->cells[i].text != it->cells[i].inline_text) {
+	    l->texts.wasted += SDL_strlen(it->cells[i].text) + 1;
+	}
+    }
+}
+
+
+/**
+ * Copy the cells of all items to a new arena once most of the cell arena is
+ * wasted on cells of removed items, or on cells that were outgrown.
+ **/
+static void ListUI_CompactCells(SDL_ListUI* l)
+{
+    ListUI_Arena cells = {0};
+    ListUI_Item* it;
+    ListUI_Cell* p;
+    size_t size = 0;
+
+    if(l->cells.wasted < LISTUI_ARENA_CHUNK ||
+       l->cells.wasted < l->cells.used / 2) {
+	return;
+    }
+
+    for(int i=0; i<l->items.nb; i++) {
+	size += l->items.hot[i].max_cells * sizeof(ListUI_Cell);
+    }
+
+    // Nothing is left to copy if no item holds any cells
+    if(!size) {
+	ListUI_ArenaReset(&l->cells);
+	return;
+    }
+    if(!(p=ListUI_ArenaAlloc(&cells, size, sizeof(void*)))) {
+	return;
+    }
+
+    for(int i=0; i<l->items.nb; i++) {
+	it = &l->items.hot[i];
+	for(int j=0; j<it->nb_cells; j++) {
+	    p[j] = it->cells[j];
+	    if(it->cells[j].text == it->cells[j].inline_text) {
+		p[j].text = p[j].inline_text;
+	    }
+	}
+	it->cells = p;
+	if(it->nb_cells) {
+	    it->label = p[0].text;
+	}
+	p += it->max_cells;
+    }
+
+    cells.high_water = SDL_max(cells.high_water, l->cells.high_water);
+    ListUI_ArenaFree(&l->cells);
+    l->cells = cells;
+}
+
+
+/**
+ * Copy the text of all items to a new arena once most of the text arena is
+ * wasted on text that was replaced or removed.
+ **/
+static void ListUI_CompactTexts(SDL_ListUI* l)
+{
+    ListUI_Arena texts = {0};
+    ListUI_Cell* cell;
+    size_t size = 0;
+    size_t n;
+    char* p;
+
+    if(l->texts.wasted < LISTUI_ARENA_CHUNK ||
+       l->texts.wasted < l->texts.used / 2) {
+	return;
+    }
+
+    for(int i=0; i<l->items.nb; i++) {
+	for(int j=0; j<l->items.hot[i].nb_cells; j++) {
+	    cell = &l->items.hot[i].cells[j];
+	    if(cell->text != cell->inline_text) {
+		size += SDL_strlen(cell->text) + 1;
+	    }
+	}
+    }
+
+    // Nothing is left to copy if no item holds any text in the arena
+    if(!size) {
+	ListUI_ArenaReset(&l->texts);
+	return;
+    }
+    if(!(p=ListUI_ArenaAlloc(&texts, size, 1))) {
+	return;
+    }
+
+    for(int i=0; i<l->items.nb; i++) {
+	for(int j=0; j<l->items.hot[i].nb_cells; j++) {
+	    cell = &l->items.hot[i].cells[j];
+	    if(cell->text != cell->inline_text) {
+		n = SDL_strlen(cell->text) + 1;
+		SDL_memcpy(p, cell->text, n);
+		cell->text = p;
+		p += n;
+	    }
+	}
+	if(l->items.hot[i].nb_cells) {
+	    l->items.hot[i].label = l->items.hot[i].cells[0].text;
+	}
+    }
+
+    texts.high_water = SDL_max(texts.high_water, l->texts.high_water);
+    ListUI_ArenaFree(&l->texts);
+    l->texts = texts;
+}
+
+
+/**
+ * Reclaim memory that is wasted in the arenas, if most of it is. Nothing is
+ * reclaimed if there is no memory for the copies.
+ **/
+static void ListUI_Compact(SDL_ListUI* l)
+{
+    ListUI_CompactCells(l);
+    ListUI_CompactTexts(l);
+}
+
+
+static void ListUI_FreeEvictions(ListUI_Eviction* evictions, int n)
+{
+    for(int i=0; i<n; i++) {
+	SDL_free(evictions[i].label);
+    }
+    SDL_free(evictions);
+}
+
+
+/**
+ * Record that cached textures with the given label, or with the given color
+ * if the label is NULL, are stale.
+ **/
+static void ListUI_QueueEviction(SDL_ListUI* l, const char* label,
+				 SDL_Color color)
+{
+    ListUI_Eviction* evictions;
+    int max;
+
+    // A flush already evicts everything
+    if(l->pending.flush) {
+	return;
+    }
+
+    if(l->pending.nb_evictions == l->pending.max_evictions) {
+	max = SDL_max(16, l->pending.max_evictions * 2);
+	if(!(evictions=SDL_realloc(l->pending.evictions,
+				   max * sizeof(ListUI_Eviction)))) {
+	    l->pending.flush = SDL_TRUE;
+	    return;
+	}
+	l->pending.evictions = evictions;
+	l->pending.max_evictions = max;
+    }
+
+    evictions = &l->pending.evictions[l->pending.nb_evictions++];
+    evictions->label = label ? SDL_strdup(label) : 0;
+    evictions->color = color;
+}
+
+
+static void ListUI_FreeSnapshot(ListUI_Snapshot* s)
+{
+    if(!s) {
+	return;
+    }
+
+    for(int i=0; i<s->nb_rows + s->nb_ahead; i++) {
+	for(int j=0; j<s->rows[i].nb_cells; j++) {
+	    if(s->rows[i].cells[j].text != s->rows[i].cells[j].inline_text) {
+		SDL_free(s->rows[i].cells[j].text);
+	    }
+	}
+    }
+    ListUI_FreeEvictions(s->evictions, s->nb_evictions);
+    SDL_free(s->rows);
+    SDL_free(s->title);
+    SDL_free(s);
+}
+
+
+SDL_ListUI* ListUI_Create(const char* title)
+{
+    SDL_ListUI* l = SDL_calloc(1, sizeof(SDL_ListUI));
+
+    l->text_color.r = 240;
+    l->text_color.g = 240;
+    l->text_color.b = 240;
+    l->text_color.a = 120;
+
+    l->activate_color.r = 240;
+    l->activate_color.g = 240;
+    l->activate_color.b = 240;
+    l->activate_color.a = 255;
+
+    l->selected_color.r = 120;
+    l->selected_color.g = 120;
+    l->selected_color.b = 0;
+    l->selected_color.a = 255;
+
+    l->background_color.a = 255;
+
+    l->nb_columns = 1;
+    l->handles.epoch = 1;
+    l->filter.pin = -1;
+    l->filter.index.column = -1;
+
+    l->cache.budget = LISTUI_CACHE_BUDGET;
+    l->cache_budget = LISTUI_CACHE_BUDGET;
+
+    ListUI_SetTitle(l, title);
+
+    return l;
+}
+
+
+void ListUI_Clear(SDL_ListUI* l)
+{
+    // Items, their cells and text are released at once, and a new epoch
+    // makes sure that ids of released items are rejected. Epoch 0 is never
+    // used, so that no id is 0.
+    l->items.nb = 0;
+    ListUI_ArenaReset(&l->cells);
+    ListUI_ArenaReset(&l->texts);
+    l->handles.nb_slots = 0;
+    l->handles.free = 0;
+    if(!++l->handles.epoch) {
+	l->handles.epoch++;
+    }
+
+    l->top = l->selected = 0;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+    l->filter.nb_matches = 0;
+    ListUI_FilterMoved(l, 0);
+
+    ListUI_FreeEvictions(l->pending.evictions, l->pending.nb_evictions);
+    l->pending.evictions = 0;
+    l->pending.nb_evictions = l->pending.max_evictions = 0;
+    l->pending.flush = SDL_TRUE;
+}
+
+
+void ListUI_Destroy(SDL_ListUI* l)
+{
+
+    if(l->on_destroy.fn) {
+	l->on_destroy.fn(l->on_destroy.ctx, l);
+    }
+
+    ListUI_Clear(l);
+    if(l->prefetch) {
+	Prefetch_Destroy(l->prefetch);
+    }
+    if(l->atlas) {
+	GlyphAtlas_Save(l->atlas);
+	GlyphAtlas_Destroy(l->atlas);
+    }
+    if(l->damage.target) {
+	SDL_DestroyTexture(l->damage.target);
+    }
+    SDL_free(l->damage.rows);
+    ListUI_FreeSnapshot(SDL_AtomicSetPtr((void**)&l->snapshot.published, 0));
+    ListUI_FreeSnapshot(l->snapshot.current);
+    ListUI_FreeEvictions(l->pending.evictions, l->pending.nb_evictions);
+    SDL_free(l->handles.slots);
+    SDL_free(l->reconcile.table);
+    SDL_free(l->reconcile.moves);
+    ListUI_SetDataSource(l, 0);
+    for(Uint32 i=0; i<l->filter.index.size; i++) {
+	SDL_free(l->filter.index.postings[i].items);
+    }
+    SDL_free(l->filter.index.postings);
+    SDL_free(l->filter.matches);
+    SDL_free(l->filter.query);
+    SDL_free(l->items.hot);
+    SDL_free(l->items.cold);
+    ListUI_ArenaFree(&l->cells);
+    ListUI_ArenaFree(&l->texts);
+    SDL_free(l->atlas_cache.dir);
+    SDL_free(l->atlas_cache.font_path);
+    SDL_free(l->title);
+    SDL_free(l);
+}
+
+
+void ListUI_OnDestroy(SDL_ListUI* l, ListUI_OnDestroyCallback* fn, void* ctx)
+{
+    l->on_destroy.fn = fn;
+    l->on_destroy.ctx = ctx;
+}
+
+
+void ListUI_SetTitle(SDL_ListUI* l, const char* title)
+{
+    if(!title) {
+	title = "";
+    }
+    if(l->title) {
+	ListUI_QueueEviction(l, l->title, (SDL_Color){0});
+	SDL_free(l->title);
+    }
+    l->title = SDL_strdup(title);
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetTextColor(SDL_ListUI* l, SDL_Color c)
+{
+    ListUI_QueueEviction(l, 0, l->text_color);
+    l->text_color = c;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetSelectedColor(SDL_ListUI* l, SDL_Color c)
+{
+    l->selected_color = c;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetActivateTextColor(SDL_ListUI* l, SDL_Color c)
+{
+    ListUI_QueueEviction(l, 0, l->activate_color);
+    l->activate_color = c;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetBackgroundColor(SDL_ListUI* l, SDL_Color c)
+{
+    l->background_color = c;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetCacheBudget(SDL_ListUI* l, size_t budget)
+{
+    l->cache_budget = budget;
+    l->dirty = SDL_TRUE;
+}
+
+
+void ListUI_SetRenderPath(SDL_ListUI* l, ListUI_RenderPath p)
+{
+    l->render_path = p;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetTextRenderer(SDL_ListUI* l, ListUI_TextRenderer r)
+{
+    l->text_renderer = r;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_SetAtlasCache(SDL_ListUI* l, const char* dir,
+			  const char* font_path, int ptsize)
+{
+    SDL_free(l->atlas_cache.dir);
+    SDL_free(l->atlas_cache.font_path);
+
+    l->atlas_cache.dir = dir ? SDL_strdup(dir) : 0;
+    l->atlas_cache.font_path = font_path ? SDL_strdup(font_path) : 0;
+    l->atlas_cache.ptsize = ptsize;
+}
+
+
+void ListUI_GetAtlasStats(SDL_ListUI* l, GlyphAtlas_Stats* stats)
+{
+    if(l->atlas) {
+	GlyphAtlas_GetStats(l->atlas, stats);
+    } else {
+	SDL_memset(stats, 0, sizeof(GlyphAtlas_Stats));
+    }
+}
+
+
+int ListUI_SetPrefetch(SDL_ListUI* l, const char* font_path, int ptsize,
+		       int nb_rows)
+{
+    if(l->prefetch) {
+	Prefetch_Destroy(l->prefetch);
+	l->prefetch = 0;
+    }
+
+    l->prefetch_rows = SDL_max(0, nb_rows);
+    if(!font_path) {
+	return 0;
+    }
+    if(!(l->prefetch=Prefetch_Create(font_path, ptsize))) {
+	return -1;
+    }
+
+    return 0;
+}
+
+
+void ListUI_GetPrefetchStats(SDL_ListUI* l, Prefetch_Stats* stats)
+{
+    if(l->prefetch) {
+	Prefetch_GetStats(l->prefetch, stats);
+    } else {
+	SDL_memset(stats, 0, sizeof(Prefetch_Stats));
+    }
+}
+
+
+void ListUI_GetMemoryStats(SDL_ListUI* l, size_t* used, size_t* high_water,
+			   size_t* reserved)
+{
+    size_t size = sizeof(ListUI_Item) + sizeof(ListUI_Listeners);
+
+    if(used) {
+	*used = l->items.nb * size + l->cells.used - l->cells.wasted +
+	    l->texts.used - l->texts.wasted;
+    }
+    if(high_water) {
+	*high_water = l->items.high_water + l->cells.high_water +
+	    l->texts.high_water;
+    }
+    if(reserved) {
+	*reserved = l->items.max * size + l->cells.reserved +
+	    l->texts.reserved + l->reconcile.size * sizeof(int) +
+	    2 * l->reconcile.max_moves * sizeof(int);
+	if(l->source.cache) {
+	    *reserved += LISTUI_ROW_CACHE * sizeof(ListUI_CachedRow);
+	}
+    }
+}
+
+
+void ListUI_GetCacheStats(SDL_ListUI* l, size_t* size, Uint64* hits,
+			  Uint64* misses)
+{
+    if(size) {
+	*size = l->cache.size;
+    }
+    if(hits) {
+	*hits = l->cache.hits;
+    }
+    if(misses) {
+	*misses = l->cache.misses;
+    }
+}
+
+
+void ListUI_SetColumns(SDL_ListUI* l, int nb_columns, const int* widths,
+		       const ListUI_Align* aligns)
+{
+    nb_columns = SDL_max(1, SDL_min(nb_columns, LISTUI_MAX_COLUMNS));
+
+    for(int i=0; i<nb_columns; i++) {
+	l->columns[i].width = widths ? widths[i] : 0;
+	l->columns[i].align = aligns ? aligns[i] : LISTUI_ALIGN_LEFT;
+    }
+    l->nb_columns = nb_columns;
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+Uint64 ListUI_AppendItem(SDL_ListUI* l, const char* label)
+{
+    return ListUI_AppendCells(l, &label, 1);
+}
+
+
+/**
+ * Make room for the given number of items in the arrays of items.
+ **/
+static int ListUI_ReserveItems(SDL_ListUI* l, int nb_items)
+{
+    ListUI_Listeners* cold;
+    ListUI_Item* hot;
+    int max = SDL_max(64, l->items.max);
+
+    if(nb_items <= l->items.max) {
+	return 0;
+    }
+
+    while(max < nb_items) {
+	max *= 2;
+    }
+    if(!(hot=SDL_realloc(l->items.hot, max * sizeof(ListUI_Item)))) {
+	return -1;
+    }
+    l->items.hot = hot;
+    if(!(cold=SDL_realloc(l->items.cold, max * sizeof(ListUI_Listeners)))) {
+	return -1;
+    }
+    l->items.cold = cold;
+    l->items.max = max;
+
+    return 0;
+}
+
+
+/**
+ * Move the cells of an item to a new block in the cell arena that holds
+ * the given number of cells.
+ **/
+static int ListUI_GrowCells(SDL_ListUI* l, ListUI_Item* it, int max_cells)
+{
+    ListUI_Cell* cells = ListUI_ArenaAlloc(&l->cells,
+					   max_cells * sizeof(ListUI_Cell),
+					   sizeof(void*));
+
+    if(!cells) {
+	return -1;
+    }
+
+    for(int i=0; i<it->nb_cells; i++) {
+	cells[i] = it->cells[i];
+	if(it->cells[i].text == it->cells[i].inline_text) {
+	    cells[i].text = cells[i].inline_text;
+	}
+    }
+
+    l->cells.wasted += it->max_cells * sizeof(ListUI_Cell);
+    it->cells = cells;
+    it->max_cells = max_cells;
+    if(it->nb_cells) {
+	it->label = cells[0].text;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Record the memory taken by the items of the list in its statistics.
+ **/
+static void ListUI_TrackItems(SDL_ListUI* l)
+{
+    size_t size = sizeof(ListUI_Item) + sizeof(ListUI_Listeners);
+
+    l->items.high_water = SDL_max(l->items.high_water, l->items.nb * size);
+}
+
+
+Uint64 ListUI_AppendCells(SDL_ListUI* l, const char** cells, int nb_cells)
+{
+    int n = SDL_max(1, SDL_min(nb_cells, LISTUI_MAX_COLUMNS));
+    ListUI_Item* it;
+
+    if(ListUI_ReserveItems(l, l->items.nb + 1)) {
+	return 0;
+    }
+
+    it = &l->items.hot[l->items.nb];
+    SDL_memset(it, 0, sizeof(ListUI_Item));
+    SDL_memset(&l->items.cold[l->items.nb], 0, sizeof(ListUI_Listeners));
+
+    // The first cell doubles as the label of the item, and there is room
+    // for a cell in each column
+    if(ListUI_GrowCells(l, it, SDL_max(n, l->nb_columns))) {
+	return 0;
+    }
+    if(!(it->id=ListUI_AcquireSlot(l, l->items.nb))) {
+	return 0;
+    }
+
+    for(int i=0; i<n; i++) {
+	ListUI_CopyText(&it->cells[i], i < nb_cells && cells[i] ? cells[i] : "",
+			&l->texts);
+    }
+    it->nb_cells = n;
+    it->label = it->cells[0].text;
+
+    l->items.nb++;
+    ListUI_TrackItems(l);
+    l->dirty = SDL_TRUE;
+    ListUI_FilterAppended(l, l->items.nb - 1);
+
+    return it->id;
+}
+
+
+/**
+ * Return the position of the item with the given id in the list, or -1 if
+ * there is no such item.
+ **/
+static int ListUI_GetIndex(SDL_ListUI* l, Uint64 id)
+{
+    Uint32 slot = (Uint32)id;
+
+    if(slot >= l->handles.nb_slots ||
+       l->handles.slots[slot].generation != (Uint32)(id >> LISTUI_SLOT_BITS)) {
+	return -1;
+    }
+
+    return l->handles.slots[slot].index;
+}
+
+
+static void ListUI_FreeCachedRow(ListUI_CachedRow* e)
+{
+    for(int i=0; i<e->item.nb_cells; i++) {
+	if(e->cells[i].text != e->cells[i].inline_text) {
+	    SDL_free(e->cells[i].text);
+	}
+    }
+    e->item.nb_cells = 0;
+    e->index = -1;
+}
+
+
+/**
+ * Return the item at the given position in the list, requesting it from the
+ * data source unless it is cached, or NULL if the data source fails.
+ **/
+static ListUI_Item* ListUI_GetRow(SDL_ListUI* l, int index)
+{
+    ListUI_CachedRow* e;
+    ListUI_RowData row;
+
+    if(!l->source.callbacks.row) {
+	return &l->items.hot[ListUI_RowToItem(l, index)];
+    }
+
+    e = &l->source.cache[index % LISTUI_ROW_CACHE];
+    if(e->index == index) {
+	return &e->item;
+    }
+
+    SDL_memset(&row, 0, sizeof(ListUI_RowData));
+    row.id = index;
+    if(l->source.callbacks.row(l->source.callbacks.ctx, l, index, &row)) {
+	return 0;
+    }
+
+    // Rows that are requested again may have changed, so they get a new
+    // generation rather than being compared with what was drawn
+    ListUI_FreeCachedRow(e);
+    e->index = index;
+    e->item.id = row.id;
+    e->item.generation = ++l->source.generation;
+    e->item.flags = row.activate ? LISTUI_ITEM_ACTIVATE : 0;
+    e->item.cells = e->cells;
+    e->item.max_cells = LISTUI_MAX_COLUMNS;
+    e->item.nb_cells = SDL_max(1, SDL_min(row.nb_cells, LISTUI_MAX_COLUMNS));
+    for(int i=0; i<e->item.nb_cells; i++) {
+	ListUI_CopyText(&e->cells[i], i < row.nb_cells && row.cells[i] ?
+			row.cells[i] : "", 0);
+	e->cells[i].generation = e->item.generation;
+    }
+    e->item.label = e->cells[0].text;
+
+    return &e->item;
+}
+
+
+int ListUI_SetDataSource(SDL_ListUI* l, const ListUI_DataSource* source)
+{
+    if(!source || !source->row) {
+	for(int i=0; l->source.cache && i<LISTUI_ROW_CACHE; i++) {
+	    ListUI_FreeCachedRow(&l->source.cache[i]);
+	}
+	SDL_free(l->source.cache);
+	SDL_memset(&l->source, 0, sizeof(l->source));
+	l->top = l->selected = 0;
+	l->dirty = SDL_TRUE;
+	l->pending.full = SDL_TRUE;
+	return 0;
+    }
+
+    if(!l->source.cache) {
+	if(!(l->source.cache=SDL_calloc(LISTUI_ROW_CACHE,
+					sizeof(ListUI_CachedRow)))) {
+	    return -1;
+	}
+	for(int i=0; i<LISTUI_ROW_CACHE; i++) {
+	    l->source.cache[i].index = -1;
+	}
+    }
+
+    l->source.callbacks = *source;
+    l->top = l->selected = 0;
+    ListUI_InvalidateRows(l, 0, -1);
+    l->pending.full = SDL_TRUE;
+
+    return 0;
+}
+
+
+void ListUI_InvalidateRows(SDL_ListUI* l, int first, int nb_rows)
+{
+    ListUI_CachedRow* e;
+
+    if(!l->source.cache) {
+	return;
+    }
+
+    for(int i=0; i<LISTUI_ROW_CACHE; i++) {
+	e = &l->source.cache[i];
+	if(e->index >= first && (nb_rows < 0 || e->index - first < nb_rows)) {
+	    ListUI_FreeCachedRow(e);
+	}
+    }
+
+    if(l->source.callbacks.count) {
+	l->source.nb_rows = SDL_max(0, l->source.callbacks.count(
+					l->source.callbacks.ctx, l));
+    }
+    l->dirty = SDL_TRUE;
+}
+
+
+SDL_bool ListUI_SetItemLabel(SDL_ListUI* l, Uint64 id, const char* label)
+{
+    return ListUI_SetItemCell(l, id, 0, label);
+}
+
+
+/**
+ * Change the text in a column of an item, and return 1 if it changed, 0 if
+ * it did not, or -1 if there is no memory for the cell.
+ **/
+static int ListUI_UpdateCell(SDL_ListUI* l, ListUI_Item* it, int column,
+			     const char* text)
+{
+    ListUI_Cell* cell;
+    size_t old_size;
+    size_t size;
+
+    if(!text) {
+	text = "";
+    }
+
+    if(column >= it->max_cells && ListUI_GrowCells(l, it, column + 1)) {
+	return -1;
+    }
+    while(it->nb_cells <= column) {
+	ListUI_CopyText(&it->cells[it->nb_cells++], "", 0);
+    }
+    cell = &it->cells[column];
+    if(!SDL_strcmp(cell->text, text)) {
+	return 0;
+    }
+
+    // Text is overwritten where it is if it fits, and is otherwise wasted
+    // until the arena is compacted
+    ListUI_QueueEviction(l, cell->text, (SDL_Color){0});
+    size = SDL_strlen(text) + 1;
+    old_size = SDL_strlen(cell->text) + 1;
+    if(cell->text != cell->inline_text && size <= old_size &&
+       size > sizeof(cell->inline_text)) {
+	SDL_memcpy(cell->text, text, size);
+	l->texts.wasted += old_size - size;
+    } else {
+	if(cell->text != cell->inline_text) {
+	    l->texts.wasted += old_size;
+	}
+	ListUI_CopyText(cell, text, &l->texts);
+    }
+    cell->generation++;
+    it->label = it->cells[0].text;
+    l->dirty = SDL_TRUE;
+    ListUI_FilterChanged(l, column);
+
+    return 1;
+}
+
+
+SDL_bool ListUI_SetItemCell(SDL_ListUI* l, Uint64 id, int column,
+			    const char* text)
+{
+    int index = ListUI_GetIndex(l, id);
+
+    if(index < 0 || column < 0 || column >= LISTUI_MAX_COLUMNS) {
+	return SDL_FALSE;
+    }
+
+    // Only the cell is redrawn, and only its text is rasterized again
+    if(ListUI_UpdateCell(l, &l->items.hot[index], column, text) < 0) {
+	return SDL_FALSE;
+    }
+    ListUI_Compact(l);
+
+    return SDL_TRUE;
+}
+
+
+SDL_bool ListUI_OnSelect(SDL_ListUI* l, Uint64 id,
+			 ListUI_OnSelectCallback* fn, void* ctx)
+{
+    int index = ListUI_GetIndex(l, id);
+
+    if(index >= 0) {
+	l->items.cold[index].on_select.fn = fn;
+	l->items.cold[index].on_select.ctx = ctx;
+	return SDL_TRUE;
+    }
+
+    return SDL_FALSE;
+}
+
+
+SDL_bool ListUI_OnActivate(SDL_ListUI* l, Uint64 id,
+			   ListUI_OnActivateCallback* fn, void* ctx)
+{
+    int index = ListUI_GetIndex(l, id);
+    ListUI_Item* it;
+
+    if(index < 0) {
+	return SDL_FALSE;
+    }
+
+    // Items with a listener are drawn in a different color
+    it = &l->items.hot[index];
+    if(!(it->flags & LISTUI_ITEM_ACTIVATE) != !fn) {
+	it->flags ^= LISTUI_ITEM_ACTIVATE;
+	it->generation++;
+	l->dirty = SDL_TRUE;
+    }
+    l->items.cold[index].on_activate.fn = fn;
+    l->items.cold[index].on_activate.ctx = ctx;
+
+    return SDL_TRUE;
+}
+
+
+/**
+ * Find an item with the given key that was not matched yet in a hash table
+ * of item positions, and return its position, or -1 if there is none.
+ **/
+static int ListUI_FindKey(SDL_ListUI* l, const int* table, Uint32 mask,
+			  const int* moves, Uint64 key)
+{
+    Uint32 i = (Uint32)((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+
+    for(; table[i]; i=(i + 1) & mask) {
+	if(l->items.hot[table[i] - 1].key == key && moves[table[i] - 1] < 0) {
+	    return table[i] - 1;
+	}
+    }
+
+    return -1;
+}
+
+
+/**
+ * Make room for a hash table of the given size, and for the moves of the
+ * given number of items in the scratch space of ListUI_Reconcile.
+ **/
+static int ListUI_ReserveReconcile(SDL_ListUI* l, Uint32 size, int nb_items)
+{
+    int max = SDL_max(64, l->reconcile.max_moves);
+    int* table;
+    int* moves;
+
+    if(size > l->reconcile.size) {
+	if(!(table=SDL_realloc(l->reconcile.table, size * sizeof(int)))) {
+	    return -1;
+	}
+	l->reconcile.table = table;
+	l->reconcile.size = size;
+    }
+
+    if(nb_items > l->reconcile.max_moves) {
+	while(max < nb_items) {
+	    max *= 2;
+	}
+	if(!(moves=SDL_realloc(l->reconcile.moves, 2 * max * sizeof(int)))) {
+	    return -1;
+	}
+	l->reconcile.moves = moves;
+	l->reconcile.max_moves = max;
+    }
+
+    return 0;
+}
+
+
+int ListUI_Reconcile(SDL_ListUI* l, const ListUI_ItemData* data, int nb_items)
+{
+    int n = l->items.nb;
+    int max = SDL_max(n, nb_items);
+    int row = l->selected - l->top;
+    int item = l->source.callbacks.row ? -1 : ListUI_GetSelectedItem(l);
+    Uint64 selected = item >= 0 ? l->items.hot[item].key : 0;
+    Uint32 mask = 64;
+    int last = -1;
+    int ops = 0;
+    SDL_bool failed = SDL_FALSE;
+    ListUI_Listeners* listeners;
+    ListUI_Listeners cold;
+    ListUI_Item* it;
+    ListUI_Item hot;
+    int* table;
+    int* to;
+    int* from;
+    int nb_cells;
+    int changed;
+    int j;
+
+    while(mask < 2 * (Uint32)n) {
+	mask <<= 1;
+    }
+    if(ListUI_ReserveItems(l, nb_items) ||
+       ListUI_ReserveReconcile(l, mask, max)) {
+	return -1;
+    }
+
+    // The old position of each item maps to its new one, and the new
+    // position of each item to its old one, or -1 for new items
+    table = l->reconcile.table;
+    to = l->reconcile.moves;
+    from = to + max;
+    SDL_memset(table, 0, mask * sizeof(int));
+    mask--;
+
+    for(int i=0; i<n; i++) {
+	Uint32 k = (Uint32)((l->items.hot[i].key * 0x9e3779b97f4a7c15ULL) >> 32);
+	while(table[k & mask]) {
+	    k++;
+	}
+	table[k & mask] = i + 1;
+    }
+    for(int i=0; i<max; i++) {
+	to[i] = from[i] = -1;
+    }
+
+    // Items that are kept retain their id, and items that end up before
+    // an item that used to precede them have moved
+    for(int i=0; i<nb_items; i++) {
+	if((j=ListUI_FindKey(l, table, mask, to, data[i].key)) >= 0) {
+	    to[j] = i;
+	    from[i] = j;
+	    if(j < last) {
+		ops++;
+	    } else {
+		last = j;
+	    }
+	}
+    }
+
+    // Ids of items that were removed are rejected from now on, and their
+    // slots are taken by new items
+    for(int i=0; i<n; i++) {
+	if(to[i] < 0) {
+	    ListUI_ReleaseItem(l, &l->items.hot[i]);
+	    ops++;
+	}
+    }
+
+    // Removed items and unused entries make way for the new items, and all
+    // entries are then moved to their new positions in place, one cycle at
+    // a time
+    for(int i=0, k=0; i<max; i++) {
+	if(to[i] < 0) {
+	    while(from[k] >= 0) {
+		k++;
+	    }
+	    to[i] = k++;
+	}
+    }
+    for(int i=0; i<max; i++) {
+	while((j=to[i]) != i) {
+	    hot = l->items.hot[j];
+	    l->items.hot[j] = l->items.hot[i];
+	    l->items.hot[i] = hot;
+	    cold = l->items.cold[j];
+	    l->items.cold[j] = l->items.cold[i];
+	    l->items.cold[i] = cold;
+	    to[i] = to[j];
+	    to[j] = j;
+	}
+    }
+
+    for(int i=0; i<nb_items; i++) {
+	it = &l->items.hot[i];
+	listeners = &l->items.cold[i];
+
+	if(from[i] >= 0) {
+	    l->handles.slots[(Uint32)it->id].index = i;
+	} else {
+	    SDL_memset(it, 0, sizeof(ListUI_Item));
+	    SDL_memset(listeners, 0, sizeof(ListUI_Listeners));
+	    it->key = data[i].key;
+	    // Items past one that cannot be inserted are left out
+	    if(ListUI_GrowCells(l, it, SDL_max(1, l->nb_columns)) ||
+	       !(it->id=ListUI_AcquireSlot(l, i))) {
+		for(j=i + 1; j<nb_items; j++) {
+		    if(from[j] >= 0) {
+			ListUI_ReleaseItem(l, &l->items.hot[j]);
+		    }
+		}
+		failed = SDL_TRUE;
+		nb_items = i;
+		break;
+	    }
+	    ListUI_CopyText(&it->cells[it->nb_cells++], "", 0);
+	    it->label = it->cells[0].text;
+	    ops++;
+	}
+
+	// Only cells whose text changed are redrawn and rasterized again, and
+	// cells past the last column are left out
+	nb_cells = SDL_max(0, SDL_min(data[i].nb_cells, LISTUI_MAX_COLUMNS));
+	changed = 0;
+	for(j=0; j<SDL_max(nb_cells, it->nb_cells); j++) {
+	    changed |= ListUI_UpdateCell(l, it, j, j < nb_cells ?
+					 data[i].cells[j] : "") > 0;
+	}
+	if(!(it->flags & LISTUI_ITEM_ACTIVATE) != !data[i].on_activate) {
+	    it->flags ^= LISTUI_ITEM_ACTIVATE;
+	    it->generation++;
+	    changed = 1;
+	}
+	if(changed && from[i] >= 0) {
+	    ops++;
+	}
+	listeners->on_select.fn = data[i].on_select;
+	listeners->on_select.ctx = data[i].ctx;
+	listeners->on_activate.fn = data[i].on_activate;
+	listeners->on_activate.ctx = data[i].ctx;
+    }
+
+    l->items.nb = nb_items;
+    ListUI_TrackItems(l);
+    ListUI_Compact(l);
+
+    // The selection stays with its key, in the same row of the view, or at
+    // the same position if its item was removed. The selection of a data
+    // source is a row rather than an item, and is left as is.
+    if(l->source.callbacks.row) {
+	ListUI_FilterMoved(l, -1);
+    } else {
+	for(int i=0; i<nb_items && item >= 0; i++) {
+	    if(l->items.hot[i].key == selected) {
+		item = i;
+		break;
+	    }
+	}
+	item = SDL_max(0, SDL_min(item, nb_items - 1));
+	ListUI_FilterMoved(l, item);
+	if(!l->filter.query) {
+	    l->selected = item;
+	    l->top = SDL_max(0, SDL_min(item - row, nb_items - l->nb_visible));
+	}
+    }
+
+    if(ops) {
+	l->dirty = SDL_TRUE;
+    }
+
+    return failed ? -1 : ops;
+}
+
+
+/**
+ * Scroll as little as possible for the item at the given index to be in
+ * view, with a row of context above and below it while there is room.
+ **/
+static void ListUI_ScrollTo(SDL_ListUI* l, int index)
+{
+    int margin = l->nb_visible > 2 ? 1 : 0;
+
+    if(l->nb_visible <= 0) {
+	return;
+    }
+
+    if(index - margin < l->top) {
+	l->top = index - margin;
+    }
+    if(index + margin >= l->top + l->nb_visible) {
+	l->top = index + margin - l->nb_visible + 1;
+    }
+    l->top = SDL_max(0, SDL_min(l->top, ListUI_GetCount(l) - l->nb_visible));
+}
+
+
+/**
+ * Invoke the OnSelect or OnActivate listener of the selected row, which
+ * belongs either to the item, or to the data source.
+ **/
+static void ListUI_Notify(SDL_ListUI* l, SDL_bool activate)
+{
+    ListUI_Listeners* listeners;
+    ListUI_OnSelectCallback* fn;
+    ListUI_Item* it;
+    void* ctx;
+
+    if(l->selected >= ListUI_GetCount(l) ||
+       !(it=ListUI_GetRow(l, l->selected))) {
+	return;
+    }
+
+    if(l->source.callbacks.row) {
+	fn = activate ? l->source.callbacks.on_activate :
+	    l->source.callbacks.on_select;
+	ctx = l->source.callbacks.ctx;
+    } else {
+	listeners = &l->items.cold[ListUI_RowToItem(l, l->selected)];
+	fn = activate ? listeners->on_activate.fn : listeners->on_select.fn;
+	ctx = activate ? listeners->on_activate.ctx : listeners->on_select.ctx;
+    }
+
+    if(fn) {
+	fn(ctx, l, it->id);
+    }
+}
+
+
+/**
+ * Move the selection cursor to the item at the given index, which is in
+ * the given direction of the current selection.
+ **/
+static void ListUI_NavigateTo(SDL_ListUI* l, int index, int dir,
+			      SDL_bool silent)
+{
+    int selected = l->selected;
+    int top = l->top;
+    int n = ListUI_GetCount(l);
+
+    if(!n) {
+	return;
+    }
+
+    l->selected = SDL_max(0, SDL_min(index, n - 1));
+    ListUI_ScrollTo(l, l->selected);
+
+    if(l->selected != selected || l->top != top) {
+	l->dirty = SDL_TRUE;
+	l->scroll_dir = dir;
+    }
+
+    if(!silent) {
+	ListUI_Notify(l, SDL_FALSE);
+    }
+}
+
+
+/**
+ * Compute how many items a page holds, i.e., the number of visible rows,
+ * minus one that stays in view when the page is turned.
+ **/
+static int ListUI_GetPageSize(SDL_ListUI* l)
+{
+    return SDL_min(ListUI_GetCount(l), l->nb_visible) - 1;
+}
+
+
+void ListUI_NavigateBy(SDL_ListUI* l, int delta, SDL_bool silent,
+		       SDL_bool wraparound)
+{
+    int index = l->selected + delta;
+    int last = ListUI_GetCount(l) - 1;
+
+    // Moves stop at either end of the list, and wrap around from there
+    if(index < 0) {
+	index = wraparound && !l->selected ? last : 0;
+    } else if(index > last) {
+	index = wraparound && l->selected == last ? 0 : last;
+    }
+
+    ListUI_NavigateTo(l, index, delta < 0 ? -1 : 1, silent);
+}
+
+
+void ListUI_NavigateItemUp(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+{
+    ListUI_NavigateBy(l, -1, silent, wraparound);
+}
+
+
+void ListUI_NavigateItemDown(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+{
+    ListUI_NavigateBy(l, 1, silent, wraparound);
+}
+
+
+void ListUI_NavigatePageUp(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+{
+    int n = ListUI_GetPageSize(l);
+
+    if(n > 0) {
+	ListUI_NavigateBy(l, -n, silent, wraparound);
+    }
+}
+
+
+void ListUI_NavigatePageDown(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound)
+{
+    int n = ListUI_GetPageSize(l);
+
+    if(n > 0) {
+	ListUI_NavigateBy(l, n, silent, wraparound);
+    }
+}
+
+
+void ListUI_NavigateToIndex(SDL_ListUI* l, int index, SDL_bool silent)
+{
+    ListUI_NavigateTo(l, index, index < l->selected ? -1 : 1, silent);
+}
+
+
+int ListUI_GetSelectedIndex(SDL_ListUI* l)
+{
+    return ListUI_GetCount(l) ? l->selected : -1;
+}
+
+
+int ListUI_GetItemCount(SDL_ListUI* l)
+{
+    return ListUI_GetCount(l);
+}
+
+
+void ListUI_GetDamageStats(SDL_ListUI* l, int* rows, SDL_bool* full)
+{
+    if(rows) {
+	*rows = l->damage.redrawn;
+    }
+    if(full) {
+	*full = l->damage.full || l->pending.full;
+    }
+}
+
+
+SDL_bool ListUI_IsDirty(SDL_ListUI* l)
+{
+    return l->dirty;
+}
+
+
+void ListUI_Invalidate(SDL_ListUI* l)
+{
+    l->dirty = SDL_TRUE;
+    l->pending.full = SDL_TRUE;
+}
+
+
+void ListUI_ActivateSelected(SDL_ListUI* l)
+{
+    ListUI_Notify(l, SDL_TRUE);
+}
+
+
+/**
+ * Compute how many rows fit below the title in output of the given height.
+ **/
+static int ListUI_GetRowCount(int h, int item_height)
+{
+    int padding = item_height / 4;
+    int first_row = padding + item_height + padding;
+
+    return SDL_max(0, (h - first_row - 1) / item_height);
+}
+
+
+/**
+ * Make sure the selected item is in view given the number of rows that fit.
+ **/
+static void ListUI_Layout(SDL_ListUI* l, int nb_rows)
+{
+    l->nb_visible = nb_rows;
+    l->selected = SDL_max(0, SDL_min(l->selected, ListUI_GetCount(l) - 1));
+    ListUI_ScrollTo(l, l->selected);
+}
+
+
+static void ListUI_CopyRow(SDL_ListUI* l, int index, ListUI_SnapshotRow* row)
+{
+    ListUI_Item* it = ListUI_GetRow(l, index);
+
+    // Rows that the data source fails to provide are left blank
+    if(!it) {
+	return;
+    }
+
+    row->id = it->id;
+    row->generation = it->generation;
+    row->selected = index == l->selected;
+    row->activate = (it->flags & LISTUI_ITEM_ACTIVATE) != 0;
+
+    for(int i=0; i<it->nb_cells; i++) {
+	ListUI_CopyText(&row->cells[i], it->cells[i].text, 0);
+	row->cells[i].generation = it->cells[i].generation;
+	row->nb_cells++;
+    }
+}
+
+
+/**
+ * Fold a snapshot that was superseded before the renderer took it into its
+ * successor, so that none of the changes it carries are lost.
+ **/
+static void ListUI_MergeSnapshot(ListUI_Snapshot* s, ListUI_Snapshot* old)
+{
+    ListUI_Eviction* evictions;
+    int n = old->nb_evictions + s->nb_evictions;
+
+    s->full |= old->full;
+    s->flush |= old->flush;
+    if(old->stamp && (!s->stamp || old->stamp < s->stamp)) {
+	s->stamp = old->stamp;
+    }
+
+    if(!s->flush && old->nb_evictions) {
+	if(!(evictions=SDL_realloc(old->evictions,
+				   n * sizeof(ListUI_Eviction)))) {
+	    s->flush = SDL_TRUE;
+	} else {
+	    SDL_memcpy(evictions + old->nb_evictions, s->evictions,
+		       s->nb_evictions * sizeof(ListUI_Eviction));
+	    SDL_free(s->evictions);
+	    s->evictions = evictions;
+	    s->nb_evictions = n;
+	    old->evictions = 0;
+	    old->nb_evictions = 0;
+	}
+    }
+
+    // Evicting everything supersedes individual evictions
+    if(s->flush) {
+	ListUI_FreeEvictions(s->evictions, s->nb_evictions);
+	s->evictions = 0;
+	s->nb_evictions = 0;
+    }
+}
+
+
+void ListUI_Publish(SDL_ListUI* l, int h, TTF_Font* font, Uint64 stamp)
+{
+    int nb_rows = ListUI_GetRowCount(h, (int)TTF_FontHeight(font));
+    int nb_ahead = l->prefetch ? l->prefetch_rows : 0;
+    ListUI_Snapshot* s = SDL_calloc(1, sizeof(ListUI_Snapshot));
+    ListUI_Snapshot* old;
+    int index;
+
+    // The list stays dirty, and publishing is retried later
+    if(!s) {
+	return;
+    }
+    if(!(s->rows=SDL_calloc(nb_rows + nb_ahead + 1,
+			    sizeof(ListUI_SnapshotRow)))) {
+	SDL_free(s);
+	return;
+    }
+
+    ListUI_Layout(l, nb_rows);
+
+    s->title = SDL_strdup(l->title);
+    s->text_color = l->text_color;
+    s->activate_color = l->activate_color;
+    s->selected_color = l->selected_color;
+    s->background_color = l->background_color;
+    SDL_memcpy(s->columns, l->columns, sizeof(s->columns));
+    s->nb_columns = l->nb_columns;
+    s->render_path = l->render_path;
+    s->text_renderer = l->text_renderer;
+    s->cache_budget = l->cache_budget;
+    s->stamp = stamp;
+
+    // Visible rows, and rows past the end of the list are left blank
+    s->nb_rows = nb_rows;
+    for(int i=0; i<nb_rows && l->top + i < ListUI_GetCount(l); i++) {
+	ListUI_CopyRow(l, l->top + i, &s->rows[i]);
+    }
+
+    // Rows that are about to scroll into view
+    index = l->scroll_dir < 0 ? l->top - 1 : l->top + nb_rows;
+    while(index >= 0 && index < ListUI_GetCount(l) && s->nb_ahead < nb_ahead) {
+	ListUI_CopyRow(l, index, &s->rows[nb_rows + s->nb_ahead++]);
+	index += l->scroll_dir < 0 ? -1 : 1;
+    }
+
+    s->full = l->pending.full;
+    s->flush = l->pending.flush;
+    s->evictions = l->pending.evictions;
+    s->nb_evictions = l->pending.nb_evictions;
+    SDL_memset(&l->pending, 0, sizeof(l->pending));
+
+    // Only the renderer clears the published snapshot, so it stays cleared
+    // while the superseded one is merged into the new one
+    if((old=SDL_AtomicSetPtr((void**)&l->snapshot.published, 0))) {
+	ListUI_MergeSnapshot(s, old);
+	ListUI_FreeSnapshot(old);
+    }
+    SDL_AtomicSetPtr((void**)&l->snapshot.published, s);
+    l->dirty = SDL_FALSE;
+}
+
+
+SDL_bool ListUI_BuildIndex(SDL_ListUI* l)
+{
+    // Only the filter searches the index, and not while a data source is set
+    if(!l->filter.query || l->source.callbacks.row) {
+	return SDL_FALSE;
+    }
+
+    return !ListUI_UpdateIndex(l, LISTUI_INDEX_SLICE);
+}
+
+
+/**
+ * Carry out texture cache invalidations recorded by the thread that mutates
+ * the list.
+ **/
+static void ListUI_ApplyEvictions(SDL_ListUI* l, ListUI_Snapshot* s)
+{
+    ListUI_Eviction* e;
+
+    if(s->flush) {
+	ListUI_CacheFlush(&l->cache);
+    }
+    for(int i=0; i<s->nb_evictions; i++) {
+	e = &s->evictions[i];
+	if(e->label) {
+	    ListUI_CacheEvictLabel(&l->cache, e->label);
+	} else {
+	    ListUI_CacheEvictColor(&l->cache, e->color);
+	}
+    }
+
+    l->cache.budget = s->cache_budget;
+    while(l->cache.size > l->cache.budget && l->cache.last) {
+	ListUI_CacheEvict(&l->cache, l->cache.last);
+    }
+}
+
+
+/**
+ * Make sure the glyph atlas matches the given renderer and font. When an
+ * on-disk cache is configured, glyphs are mapped from it, or rasterized
+ * and written to it if the cache is missing or stale.
+ **/
+static void ListUI_PrepareAtlas(SDL_ListUI* l, ListUI_Snapshot* s,
+				SDL_Renderer* renderer, TTF_Font* font)
+{
+    ListUI_SnapshotRow* row;
+
+    if(l->atlas && GlyphAtlas_Matches(l->atlas, renderer, font)) {
+	return;
+    }
+
+    if(l->atlas) {
+	GlyphAtlas_Save(l->atlas);
+	GlyphAtlas_Destroy(l->atlas);
+    }
+    if(!(l->atlas=GlyphAtlas_Create(renderer, font))) {
+	return;
+    }
+
+    if(!l->atlas_cache.dir || !l->atlas_cache.font_path) {
+	return;
+    }
+    if(!GlyphAtlas_Load(l->atlas, l->atlas_cache.dir,
+			l->atlas_cache.font_path, l->atlas_cache.ptsize)) {
+	return;
+    }
+
+    GlyphAtlas_Prebake(l->atlas, LISTUI_PREBAKE_TEXT);
+    if(s->title) {
+	GlyphAtlas_Prebake(l->atlas, s->title);
+    }
+    for(int i=0; i<s->nb_rows + s->nb_ahead; i++) {
+	row = &s->rows[i];
+	for(int j=0; j<row->nb_cells; j++) {
+	    GlyphAtlas_Prebake(l->atlas, row->cells[j].text);
+	}
+    }
+    GlyphAtlas_Save(l->atlas);
+}
+
+
+/**
+ * Hand glyphs and labels that were rasterized in the background over to the
+ * glyph atlas and texture cache.
+ **/
+static void ListUI_CollectPrefetched(SDL_ListUI* l, SDL_Renderer* renderer,
+				     TTF_Font* font)
+{
+    Prefetch_Job job;
+
+    while(Prefetch_Poll(l->prefetch, &job)) {
+	if(job.kind == PREFETCH_GLYPH) {
+	    if(l->atlas) {
+		GlyphAtlas_InsertGlyph(l->atlas, job.codepoint, job.surface,
+				       job.advance);
+	    }
+	} else if(!ListUI_CacheLookup(&l->cache, renderer, job.text, font,
+				      job.color)) {
+	    ListUI_CacheInsert(&l->cache, renderer, job.text, font, job.color,
+			       job.surface);
+	}
+	Prefetch_Release(&job);
+    }
+}
+
+
+/**
+ * Return SDL_TRUE if text can be drawn without rasterizing it first. When a
+ * background rasterizer is running, missing text is requested from it, and
+ * SDL_FALSE is returned.
+ **/
+static SDL_bool ListUI_TextReady(SDL_ListUI* l, ListUI_Canvas* c,
+				 const char* text, SDL_Color color)
+{
+    Uint32 missing[LISTUI_PREFETCH_MAX];
+    int n;
+
+    if(!l->prefetch || !*text) {
+	return SDL_TRUE;
+    }
+
+    if(c->atlas) {
+	n = GlyphAtlas_GetMissing(l->atlas, text, missing, LISTUI_PREFETCH_MAX);
+	for(int i=0; i<n; i++) {
+	    Prefetch_RequestGlyph(l->prefetch, missing[i]);
+	}
+	return n == 0;
+    }
+
+    if(ListUI_CacheLookup(&l->cache, c->renderer, text, c->font, color)) {
+	return SDL_TRUE;
+    }
+    Prefetch_RequestText(l->prefetch, text, color);
+
+    return SDL_FALSE;
+}
+
+
+/**
+ * Request rows just beyond the visible ones, in the direction of scrolling.
+ **/
+static void ListUI_PrefetchRows(SDL_ListUI* l, ListUI_Snapshot* s,
+				ListUI_Canvas* c)
+{
+    ListUI_SnapshotRow* row;
+    SDL_Color color;
+
+    for(int i=0; i<s->nb_ahead; i++) {
+	row = &s->rows[s->nb_rows + i];
+	color = row->activate ? s->activate_color : s->text_color;
+	for(int j=0; j<row->nb_cells && j<s->nb_columns; j++) {
+	    ListUI_TextReady(l, c, row->cells[j].text, color);
+	}
+    }
+}
+
+
+static void ListUI_RenderText(SDL_ListUI* l, ListUI_Canvas* c,
+			      const char* text, int x, int y, SDL_Color color)
+{
+    ListUI_TextureEntry* e;
+    SDL_Rect rect;
+
+    if(!text || !*text) {
+	return;
+    }
+    if(c->pixels) {
+	rect.x = rect.y = 0;
+	rect.w = c->bounds.w;
+	rect.h = c->bounds.h;
+	GlyphAtlas_BlitText(l->atlas, text, x - c->bounds.x, y - c->bounds.y,
+			    color, c->pixels, c->pitch, &rect);
+	return;
+    }
+    if(c->atlas) {
+	GlyphAtlas_DrawText(l->atlas, text, x, y, color);
+	return;
+    }
+    if(!(e=ListUI_CacheGet(&l->cache, c->renderer, text, c->font, color)) ||
+       !e->texture) {
+	return;
+    }
+
+    rect.x = x;
+    rect.y = y;
+    rect.w = e->w;
+    rect.h = e->h;
+    SDL_RenderCopy(c->renderer, e->texture, NULL, &rect);
+}
+
+
+static int ListUI_MeasureText(SDL_ListUI* l, ListUI_Canvas* c,
+			      const char* text, SDL_Color color)
+{
+    ListUI_TextureEntry* e;
+
+    if(!*text) {
+	return 0;
+    }
+    if(c->atlas) {
+	return GlyphAtlas_MeasureText(l->atlas, text);
+    }
+    if(!(e=ListUI_CacheGet(&l->cache, c->renderer, text, c->font, color))) {
+	return 0;
+    }
+
+    return e->w;
+}
+
+
+/**
+ * Compute the rectangle of a column in the given row rectangle. The last
+ * column extends to the right edge of the row.
+ **/
+static void ListUI_GetCellRect(ListUI_Snapshot* s, int column,
+			       const SDL_Rect* row, SDL_Rect* rect)
+{
+    *rect = *row;
+    for(int i=0; i<column; i++) {
+	rect->x += s->columns[i].width;
+    }
+    if(column < s->nb_columns - 1) {
+	rect->w = s->columns[column].width;
+    } else {
+	rect->w = SDL_max(0, row->x + row->w - rect->x);
+    }
+}
+
+
+static void ListUI_RenderCell(SDL_ListUI* l, ListUI_Canvas* c,
+			      const char* text, const SDL_Rect* rect,
+			      ListUI_Align align, int padding, SDL_Color color)
+{
+    int x = rect->x + padding;
+
+    if(!text || !*text) {
+	return;
+    }
+
+    if(align == LISTUI_ALIGN_RIGHT) {
+	x = rect->x + rect->w - padding - ListUI_MeasureText(l, c, text, color);
+    } else if(align == LISTUI_ALIGN_CENTER) {
+	x = rect->x + (rect->w - ListUI_MeasureText(l, c, text, color)) / 2;
+    }
+
+    ListUI_RenderText(l, c, text, x, rect->y, color);
+}
+
+
+static void ListUI_FillRect(ListUI_Canvas* c, const SDL_Rect* rect,
+			    SDL_Color color, SDL_BlendMode mode)
+{
+    SDL_Rect r;
+
+    if(c->pixels) {
+	if(!SDL_IntersectRect(rect, &c->bounds, &r)) {
+	    return;
+	}
+	r.x -= c->bounds.x;
+	r.y -= c->bounds.y;
+	if(mode == SDL_BLENDMODE_NONE) {
+	    Compose_FillRect(c->pixels, c->pitch, &r, color);
+	} else {
+	    Compose_BlendRect(c->pixels, c->pitch, &r, color);
+	}
+	return;
+    }
+
+    SDL_SetRenderDrawBlendMode(c->renderer, mode);
+    SDL_SetRenderDrawColor(c->renderer, color.r, color.g, color.b, color.a);
+    SDL_RenderFillRect(c->renderer, rect);
+}
+
+
+/**
+ * Make sure there is a persistent texture that matches the output size of
+ * the given renderer and the render path; a render target for geometry, or
+ * a streaming texture for the compositor. Everything is redrawn when the
+ * texture is (re)created. Returns -1 if no such texture can be created,
+ * in which case everything is drawn directly to the output every frame.
+ **/
+static int ListUI_PrepareTarget(SDL_ListUI* l, SDL_Renderer* renderer,
+				TTF_Font* font, ListUI_RenderPath path,
+				int w, int h, int nb_rows)
+{
+    SDL_RendererInfo info;
+    ListUI_RowState* rows;
+    int access;
+    int tw, th;
+
+    if(l->damage.renderer != renderer || l->damage.font != font) {
+	l->damage.full = SDL_TRUE;
+    }
+    if(l->damage.target && (l->damage.renderer != renderer ||
+			    l->damage.path != path ||
+			    SDL_QueryTexture(l->damage.target, 0, 0, &tw, &th) ||
+			    tw != w || th != h)) {
+	SDL_DestroyTexture(l->damage.target);
+	l->damage.target = 0;
+    }
+    l->damage.renderer = renderer;
+    l->damage.font = font;
+    l->damage.path = path;
+
+    if(nb_rows != l->damage.nb_rows) {
+	if(!(rows=SDL_realloc(l->damage.rows,
+			      2 * nb_rows * sizeof(ListUI_RowState)))) {
+	    SDL_free(l->damage.rows);
+	    l->damage.rows = l->damage.next = 0;
+	    l->damage.nb_rows = 0;
+	    return -1;
+	}
+	l->damage.rows = rows;
+	l->damage.next = rows + nb_rows;
+	l->damage.nb_rows = nb_rows;
+	l->damage.full = SDL_TRUE;
+    }
+
+    if(l->damage.target) {
+	return 0;
+    }
+
+    if(path == LISTUI_RENDER_COMPOSITOR) {
+	access = SDL_TEXTUREACCESS_STREAMING;
+    } else if(SDL_RenderTargetSupported(renderer)) {
+	access = SDL_TEXTUREACCESS_TARGET;
+    } else {
+	return -1;
+    }
+    if(!(l->damage.target=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+					    access, w, h))) {
+	return -1;
+    }
+
+    // Only the software renderer retains pixels of locked streaming textures
+    l->damage.retained = SDL_TRUE;
+    if(path == LISTUI_RENDER_COMPOSITOR &&
+       (SDL_GetRendererInfo(renderer, &info) ||
+	!(info.flags & SDL_RENDERER_SOFTWARE))) {
+	l->damage.retained = SDL_FALSE;
+    }
+
+    SDL_SetTextureBlendMode(l->damage.target, SDL_BLENDMODE_NONE);
+    l->damage.full = SDL_TRUE;
+
+    return 0;
+}
+
+
+/**
+ * Compute a bit mask of the columns in a row that need to be redrawn.
+ **/
+static Uint32 ListUI_RowDamage(SDL_ListUI* l, ListUI_Snapshot* s,
+			       ListUI_RowState* a, ListUI_RowState* b)
+{
+    Uint32 all = (1U << s->nb_columns) - 1;
+    Uint32 mask = 0;
+
+    if(l->damage.full || !a->complete || a->id != b->id ||
+       a->generation != b->generation || a->selected != b->selected) {
+	return all;
+    }
+
+    for(int i=0; i<s->nb_columns; i++) {
+	if(a->cells[i] != b->cells[i]) {
+	    mask |= 1U << i;
+	}
+    }
+
+    return mask;
+}
+
+
+/**
+ * Draw a snapshot into the persistent texture, and copy the texture to the
+ * output. Returns the number of rows that were drawn without all of their
+ * text.
+ **/
+static int ListUI_Draw(SDL_ListUI* l, ListUI_Snapshot* s,
+		       SDL_Renderer* renderer, TTF_Font* font)
+{
+    int item_height = (int)TTF_FontHeight(font);
+    int padding = item_height / 4;
+    int first_row = padding + item_height + padding;
+    ListUI_Canvas canvas = {renderer, font};
+    SDL_Texture* output = 0;
+    ListUI_RenderPath path;
+    ListUI_SnapshotRow* row;
+    ListUI_RowState* next;
+    SDL_Color color;
+    SDL_Rect bounds = {0};
+    SDL_Rect cell;
+    SDL_Rect rect;
+    Uint32 mask;
+    void* pixels;
+    int incomplete = 0;
+    int x = 0;
+    int y = 0;
+    int w, h;
+
+    if(SDL_GetRendererOutputSize(renderer, &w, &h)) {
+	return 0;
+    }
+
+    // Glyphs are rasterized for a specific renderer and font
+    if(s->text_renderer == LISTUI_TEXT_ATLAS ||
+       s->render_path == LISTUI_RENDER_COMPOSITOR) {
+	ListUI_PrepareAtlas(l, s, renderer, font);
+    }
+
+    // The compositor blends glyphs from the atlas
+    path = s->render_path;
+    if(!l->atlas) {
+	path = LISTUI_RENDER_GEOMETRY;
+    }
+
+    if(ListUI_PrepareTarget(l, renderer, font, path, w, h, s->nb_rows)) {
+	path = LISTUI_RENDER_GEOMETRY;
+	l->damage.full = SDL_TRUE;
+    } else if(!l->damage.retained) {
+	l->damage.full = SDL_TRUE;
+    }
+    canvas.atlas = l->atlas && (path == LISTUI_RENDER_COMPOSITOR ||
+				s->text_renderer == LISTUI_TEXT_ATLAS);
+
+    if(l->prefetch) {
+	ListUI_CollectPrefetched(l, renderer, font);
+    }
+
+    // Figure out which rows changed since the last frame
+    if(l->damage.full) {
+	bounds.w = w;
+	bounds.h = h;
+    }
+    for(int i=0; i<l->damage.nb_rows; i++) {
+	row = &s->rows[i];
+	next = &l->damage.next[i];
+	next->id = row->id;
+	next->generation = row->generation;
+	next->selected = row->selected;
+	next->complete = SDL_TRUE;
+	for(int j=0; j<LISTUI_MAX_COLUMNS; j++) {
+	    next->cells[j] = j < row->nb_cells ? row->cells[j].generation : 0;
+	}
+
+	rect.x = x;
+	rect.y = first_row + i * item_height;
+	rect.w = w;
+	rect.h = item_height;
+	mask = l->damage.full ? 0 :
+	    ListUI_RowDamage(l, s, &l->damage.rows[i], next);
+	for(int j=0; j<s->nb_columns; j++) {
+	    if(!(mask & (1U << j))) {
+		continue;
+	    }
+	    ListUI_GetCellRect(s, j, &rect, &cell);
+	    if(SDL_RectEmpty(&bounds)) {
+		bounds = cell;
+	    } else {
+		SDL_UnionRect(&bounds, &cell, &bounds);
+	    }
+	}
+    }
+
+    l->damage.redrawn = 0;
+    if(SDL_RectEmpty(&bounds)) {
+	if(l->damage.target) {
+	    SDL_RenderCopy(renderer, l->damage.target, NULL, NULL);
+	}
+	return 0;
+    }
+
+    // Direct drawing operations to the damaged region of the texture
+    if(!l->damage.target) {
+	canvas.bounds = bounds;
+    } else if(path == LISTUI_RENDER_COMPOSITOR) {
+	if(SDL_LockTexture(l->damage.target, &bounds, &pixels, &canvas.pitch)) {
+	    l->damage.full = SDL_TRUE;
+	    return 0;
+	}
+	canvas.pixels = pixels;
+	canvas.bounds = bounds;
+    } else {
+	output = SDL_GetRenderTarget(renderer);
+	SDL_SetRenderTarget(renderer, l->damage.target);
+    }
+
+    if(l->damage.full) {
+	ListUI_FillRect(&canvas, &bounds, s->background_color,
+			SDL_BLENDMODE_NONE);
+
+	// Render title
+	y += padding;
+	ListUI_RenderText(l, &canvas, s->title, x+padding, y,
+			  s->activate_color);
+	y += item_height;
+
+	// Render horizontal line
+	rect.x = x;
+	rect.y = y;
+	rect.w = w;
+	rect.h = padding / 4;
+	ListUI_FillRect(&canvas, &rect, s->activate_color, SDL_BLENDMODE_BLEND);
+    }
+
+    // Render damaged cells, and blank out rows past the end of the list
+    for(int i=0; i<l->damage.nb_rows; i++) {
+	row = &s->rows[i];
+	next = &l->damage.next[i];
+	if(!(mask=ListUI_RowDamage(l, s, &l->damage.rows[i], next))) {
+	    continue;
+	}
+
+	rect.x = x;
+	rect.y = first_row + i * item_height;
+	rect.w = w;
+	rect.h = item_height;
+	color = row->activate ? s->activate_color : s->text_color;
+
+	for(int j=0; j<s->nb_columns; j++) {
+	    if(!(mask & (1U << j))) {
+		continue;
+	    }
+	    ListUI_GetCellRect(s, j, &rect, &cell);
+	    ListUI_FillRect(&canvas, &cell, s->background_color,
+			    SDL_BLENDMODE_NONE);
+	    if(row->selected) {
+		ListUI_FillRect(&canvas, &cell, s->selected_color,
+				SDL_BLENDMODE_BLEND);
+	    }
+	    if(j >= row->nb_cells) {
+		continue;
+	    }
+	    if(ListUI_TextReady(l, &canvas, row->cells[j].text, color)) {
+		ListUI_RenderCell(l, &canvas, row->cells[j].text, &cell,
+				  s->columns[j].align, padding, color);
+	    } else {
+		next->complete = SDL_FALSE;
+	    }
+	}
+
+	// Rows with text that is still being rasterized are drawn again
+	if(!next->complete) {
+	    incomplete++;
+	}
+	l->damage.rows[i] = *next;
+	l->damage.redrawn++;
+    }
+
+    // Submit all text in a single batch, on top of the selection
+    if(!canvas.pixels && canvas.atlas) {
+	GlyphAtlas_Flush(l->atlas);
+    }
+
+    l->damage.full = SDL_FALSE;
+
+    // Present the texture
+    if(canvas.pixels) {
+	SDL_UnlockTexture(l->damage.target);
+    } else if(l->damage.target) {
+	SDL_SetRenderTarget(renderer, output);
+    }
+    if(l->damage.target) {
+	SDL_RenderCopy(renderer, l->damage.target, NULL, NULL);
+    }
+
+    // Keep the worker busy with rows that are about to scroll into view
+    if(l->prefetch) {
+	ListUI_PrefetchRows(l, s, &canvas);
+    }
+
+    return incomplete;
+}
+
+
+int ListUI_RenderSnapshot(SDL_ListUI* l, SDL_Renderer* renderer,
+			  TTF_Font* font)
+{
+    ListUI_Snapshot* s;
+
+    if((s=SDL_AtomicSetPtr((void**)&l->snapshot.published, 0))) {
+	ListUI_FreeSnapshot(l->snapshot.current);
+	l->snapshot.current = s;
+	l->snapshot.stamp = s->stamp;
+	l->damage.full |= s->full;
+	ListUI_ApplyEvictions(l, s);
+    } else if(!(s=l->snapshot.current) || !s->incomplete) {
+	return -1;
+    } else {
+	l->snapshot.stamp = 0;
+    }
+
+    s->incomplete = ListUI_Draw(l, s, renderer, font);
+
+    return s->incomplete;
+}
+
+
+Uint64 ListUI_GetSnapshotStamp(SDL_ListUI* l)
+{
+    return l->snapshot.stamp;
+}
+
+
+void ListUI_Render(SDL_ListUI* l, SDL_Renderer* renderer, TTF_Font* font)
+{
+    int w, h;
+
+    if(SDL_GetRendererOutputSize(renderer, &w, &h)) {
+	return;
+    }
+
+    // Poll the background rasterizer again next frame while text is missing
+    ListUI_Publish(l, h, font, 0);
+    if(ListUI_RenderSnapshot(l, renderer, font) > 0) {
+	l->dirty = SDL_TRUE;
     }
 }
 
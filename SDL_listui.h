@@ -19,6 +19,9 @@ along with this program; see the file COPYING. If not, see
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "SDL_glyphatlas.h"
+#include "SDL_prefetch.h"
+
 /**
  * ListUI renders a simple user interface for a list of labeled items.
  * The UI keeps track of the currently selected item with a cursor than can
@@ -38,11 +41,72 @@ along with this program; see the file COPYING. If not, see
  *  2) OnActivate - events that occur when a selected item is activated,
  *  3) onDestroy  - events that occur when the ListUI instance is about to free
  *                  up all of its memory.
+ *
+ * The list may be rendered on a different thread than the one that mutates
+ * it. The mutating thread publishes immutable snapshots of the list with
+ * ListUI_Publish, and the rendering thread draws the latest one with
+ * ListUI_RenderSnapshot. Neither thread waits for the other. Settings of
+ * the background rasterizer and the atlas cache, and statistics, belong to
+ * the rendering thread, and must not be accessed while it is running.
  **/
 struct SDL_ListUI;
 typedef struct SDL_ListUI SDL_ListUI;
 
 
+/**
+ * Items may be split into cells that are laid out in columns, see
+ * ListUI_SetColumns.
+ **/
+#define LISTUI_MAX_COLUMNS 8
+
+
+/**
+ * Horizontal alignment of text within a column.
+ **/
+typedef enum ListUI_Align
+{
+    LISTUI_ALIGN_LEFT,
+    LISTUI_ALIGN_RIGHT,
+    LISTUI_ALIGN_CENTER,
+} ListUI_Align;
+
+
+/**
+ * How the query of a filter is matched with the text of items, ignoring
+ * case.
+ **/
+typedef enum ListUI_FilterMode
+{
+    LISTUI_FILTER_SUBSTRING,
+    LISTUI_FILTER_PREFIX,
+} ListUI_FilterMode;
+
+
+/**
+ * Text can either be rendered with glyphs from a shared atlas texture that is
+ * submitted to the renderer in a single batch, or with one cached texture
+ * per label.
+ **/
+typedef enum ListUI_TextRenderer
+{
+    LISTUI_TEXT_ATLAS,
+    LISTUI_TEXT_TEXTURES,
+} ListUI_TextRenderer;
+
+
+/**
+ * Rows can either be drawn by the renderer into a render target, or be
+ * composited by the CPU into a streaming texture. The compositor blends
+ * glyphs from the atlas with SIMD span operations, and bypasses the
+ * generic blitter of the software renderer.
+ **/
+typedef enum ListUI_RenderPath
+{
+    LISTUI_RENDER_GEOMETRY,
+    LISTUI_RENDER_COMPOSITOR,
+} ListUI_RenderPath;
+
+
 /**
  * Prototype for OnSelect event callbacks.
  **/
@@ -67,6 +131,68 @@ typedef void (ListUI_OnDestroyCallback)(void *ctx, SDL_ListUI* l);
 typedef int (ListUI_CompareCallback)(const char* s1, const char* s2);
 
 
+/**
+ * Prototype for callbacks that compute numeric sort keys of items.
+ **/
+typedef Uint64 (ListUI_SortKeyCallback)(void *ctx, SDL_ListUI* l, Uint64 id);
+
+
+/**
+ * A row that a data source provides on demand. Text is copied before the
+ * callback that provides the row is invoked again.
+ **/
+typedef struct ListUI_RowData
+{
+    Uint64      id;       // passed to event callbacks, defaults to the index
+    const char *cells[LISTUI_MAX_COLUMNS];
+    int         nb_cells;
+    SDL_bool    activate; // drawn like items with an OnActivate callback
+} ListUI_RowData;
+
+
+/**
+ * An item as given to ListUI_Reconcile. Items are matched with the items
+ * already in the list by their keys, which must be stable across calls.
+ **/
+typedef struct ListUI_ItemData
+{
+    Uint64                     key;
+    const char                *cells[LISTUI_MAX_COLUMNS];
+    int                        nb_cells;
+    ListUI_OnSelectCallback   *on_select;
+    ListUI_OnActivateCallback *on_activate;
+    void                      *ctx;       // passed to both callbacks
+} ListUI_ItemData;
+
+
+/**
+ * Prototype for callbacks that return the number of rows of a data source.
+ **/
+typedef int (ListUI_CountCallback)(void *ctx, SDL_ListUI* l);
+
+
+/**
+ * Prototype for callbacks that fill in the row of a data source at the given
+ * index, and return 0 on success, or -1 if the row cannot be provided.
+ **/
+typedef int (ListUI_RowCallback)(void *ctx, SDL_ListUI* l, int index,
+				 ListUI_RowData* row);
+
+
+/**
+ * A data source that provides the rows of a list on demand, instead of
+ * items that are appended up front.
+ **/
+typedef struct ListUI_DataSource
+{
+    ListUI_CountCallback      *count;
+    ListUI_RowCallback        *row;
+    ListUI_OnSelectCallback   *on_select;
+    ListUI_OnActivateCallback *on_activate;
+    void                      *ctx;
+} ListUI_DataSource;
+
+
 /**
  * Create a new ListUI instance.
  **/
@@ -110,25 +236,175 @@ void ListUI_SetSelectedColor(SDL_ListUI* l, SDL_Color c);
 void ListUI_SetActivateTextColor(SDL_ListUI* l, SDL_Color c);
 
 
+/**
+ * Change the background color.
+ **/
+void ListUI_SetBackgroundColor(SDL_ListUI* l, SDL_Color c);
+
+
+/**
+ * Change how rows are drawn, see ListUI_RenderPath.
+ **/
+void ListUI_SetRenderPath(SDL_ListUI* l, ListUI_RenderPath p);
+
+
+/**
+ * Change how text is rendered, see ListUI_TextRenderer.
+ **/
+void ListUI_SetTextRenderer(SDL_ListUI* l, ListUI_TextRenderer r);
+
+
+/**
+ * Keep the glyph atlas in an on-disk cache in the given directory, so that
+ * glyphs rasterized from the font at the given path and size are reused
+ * across launches.
+ **/
+void ListUI_SetAtlasCache(SDL_ListUI* l, const char* dir,
+			  const char* font_path, int ptsize);
+
+
+/**
+ * Obtain statistics gathered by the glyph atlas of a ListUI instance.
+ **/
+void ListUI_GetAtlasStats(SDL_ListUI* l, GlyphAtlas_Stats* stats);
+
+
+/**
+ * Rasterize text on a background thread with its own instance of the font
+ * at the given path and size, which must match the font that is passed to
+ * ListUI_Render. Besides the visible rows, the given number of rows beyond
+ * them in the direction of scrolling are rasterized ahead of time. Text that
+ * is not ready yet is drawn by a later frame. A NULL path stops the thread.
+ **/
+int ListUI_SetPrefetch(SDL_ListUI* l, const char* font_path, int ptsize,
+		       int nb_rows);
+
+
+/**
+ * Obtain statistics gathered by the background rasterizer of a ListUI
+ * instance.
+ **/
+void ListUI_GetPrefetchStats(SDL_ListUI* l, Prefetch_Stats* stats);
+
+
+/**
+ * Obtain the number of bytes that items and their text currently occupy,
+ * the most they have occupied since the ListUI instance was created, and
+ * the number of bytes reserved for them. Memory is reserved in chunks that
+ * are reused when the list is cleared, and text that fits in a few bytes is
+ * stored inline with its item.
+ **/
+void ListUI_GetMemoryStats(SDL_ListUI* l, size_t* used, size_t* high_water,
+			   size_t* reserved);
+
+
+/**
+ * Change the number of bytes that rasterized labels may occupy in the
+ * texture cache. Least recently used labels are evicted first.
+ **/
+void ListUI_SetCacheBudget(SDL_ListUI* l, size_t budget);
+
+
+/**
+ * Obtain the number of bytes currently occupied by the texture cache, and
+ * the number of cache hits and misses since the ListUI instance was created.
+ **/
+void ListUI_GetCacheStats(SDL_ListUI* l, size_t* size, Uint64* hits,
+			  Uint64* misses);
+
+
+/**
+ * Lay out the cells of items in columns with the given widths in pixels
+ * and alignments. The last column extends to the right edge of the list.
+ * Text is not clipped to its column.
+ **/
+void ListUI_SetColumns(SDL_ListUI* l, int nb_columns, const int* widths,
+		       const ListUI_Align* aligns);
+
+
 /**
  * Append a new item at the bottom of a ListUI instance, and
- * return a identifier that is unique to the new item.
+ * return a identifier that is unique to the new item, or 0 if out of
+ * memory. Identifiers of items removed by ListUI_Clear are rejected by
+ * all functions that take an identifier.
  **/
 Uint64 ListUI_AppendItem(SDL_ListUI* l, const char* label);
 
 
+/**
+ * Append a new item made of the given cells at the bottom of a ListUI
+ * instance, and return a identifier that is unique to the new item. The
+ * first cell is the label of the item.
+ **/
+Uint64 ListUI_AppendCells(SDL_ListUI* l, const char** cells, int nb_cells);
+
+
 /**
  * Remove all items from the list.
  **/
 void ListUI_Clear(SDL_ListUI* l);
 
 
+/**
+ * Make the items of the list match the given ordered items, by inserting,
+ * removing, moving and changing only the items that differ. Items that are
+ * kept retain their identifiers, and only cells whose text changed are
+ * redrawn. The selection stays with the item that has the same key, except
+ * while a data source is set, when it is one of its rows, and is left as is.
+ * Returns the number of items that were inserted, removed, moved or changed,
+ * or -1 if there is not enough memory for all of the items.
+ **/
+int ListUI_Reconcile(SDL_ListUI* l, const ListUI_ItemData* items,
+		     int nb_items);
+
+
+/**
+ * Show the rows of a data source instead of the items of the list, or the
+ * items again if the data source is NULL. Only rows that are about to be
+ * drawn are requested from the data source, and a bounded number of them
+ * are cached, so that the cost of a list is proportional to the viewport
+ * rather than to the number of rows. Items are kept, but are neither drawn
+ * nor sorted while a data source is set. Returns -1 if the cache cannot be
+ * allocated.
+ **/
+int ListUI_SetDataSource(SDL_ListUI* l, const ListUI_DataSource* source);
+
+
+/**
+ * Only show items whose text in the given column contains the given query,
+ * or starts with it. Queries that extend the previous one only search the
+ * items that matched it. Other queries are narrowed down with a trigram
+ * index of the column, which is built on first use and kept up to date as
+ * items are appended. The selected item stays selected while it matches.
+ * A NULL or empty query shows all items again. Returns the number of items
+ * that match, or -1 on failure, e.g., while a data source is set.
+ **/
+int ListUI_SetFilter(SDL_ListUI* l, const char* query, int column,
+		     ListUI_FilterMode mode);
+
+
+/**
+ * Discard cached rows of the data source in the given range, or all of them
+ * if nb_rows is negative, and query the number of rows again. Must be called
+ * when the rows of the data source change.
+ **/
+void ListUI_InvalidateRows(SDL_ListUI* l, int first, int nb_rows);
+
+
 /**
  * Change the label of an item with the given identifier.
  **/
 SDL_bool ListUI_SetItemLabel(SDL_ListUI* l, Uint64 id, const char* label);
 
 
+/**
+ * Change the text in a column of an item with the given identifier. Only
+ * that cell is redrawn.
+ **/
+SDL_bool ListUI_SetItemCell(SDL_ListUI* l, Uint64 id, int column,
+			    const char* text);
+
+
 /**
  * Move the selection cursor of the given ListUI instance one step towards the
  * top. Optionally, event generation may be silenced, and wrap-around
@@ -161,6 +437,40 @@ void ListUI_NavigatePageUp(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound);
 void ListUI_NavigatePageDown(SDL_ListUI* l, SDL_bool silent, SDL_bool wraparound);
 
 
+/**
+ * Move the selection cursor of the given ListUI instance by the given number
+ * of items, towards the bottom if it is positive, and notify the selected
+ * item once, even if the cursor did not move. Moves stop at either end of
+ * the list. Optionally, event generation may be silenced, and wrap-around
+ * navigation may be enabled, which moves the cursor to the other end if it
+ * already is at the end it is moved towards.
+ **/
+void ListUI_NavigateBy(SDL_ListUI* l, int delta, SDL_bool silent,
+		       SDL_bool wraparound);
+
+
+/**
+ * Move the selection cursor of the given ListUI instance to the item at the
+ * given position, counted from zero at the top of the list. Positions past
+ * either end of the list select the first or the last item. Optionally,
+ * event generation may be silenced.
+ **/
+void ListUI_NavigateToIndex(SDL_ListUI* l, int index, SDL_bool silent);
+
+
+/**
+ * Return the position of the selected item, or -1 if the list is empty.
+ **/
+int ListUI_GetSelectedIndex(SDL_ListUI* l);
+
+
+/**
+ * Return the number of items in the given ListUI instance that are shown,
+ * i.e., that match the filter, or rows of the data source if there is one.
+ **/
+int ListUI_GetItemCount(SDL_ListUI* l);
+
+
 /**
  * Change the callback function that is invoked when an item with the
  * given identifier is selected.
@@ -184,11 +494,22 @@ SDL_bool ListUI_OnActivate(SDL_ListUI* l, Uint64 id, ListUI_OnActivateCallback*
 
 
 /**
- * Sort the items in the list according the the labels of items.
+ * Sort the items in the list according the the labels of items. The sort is
+ * stable, and the selected item stays selected and in view. Without a
+ * compare callback, labels are ordered like ListUI_DefaultCompareCallback
+ * does, using keys that are computed once per item.
  **/
 void ListUI_Sort(SDL_ListUI* l, ListUI_CompareCallback* cmp);
 
 
+/**
+ * Sort the items in the list in ascending order of numeric keys, e.g.,
+ * account ids, that are computed once per item by the given callback. The
+ * sort is stable, and the selected item stays selected and in view.
+ **/
+void ListUI_SortByKey(SDL_ListUI* l, ListUI_SortKeyCallback* fn, void* ctx);
+
+
 /**
  * Default soty compare callback function that yields lexical accending order.
  **/
@@ -196,11 +517,71 @@ int ListUI_DefaultCompareCallback(const char* s1, const char* s2);
 
 
 /**
- * Render a ListUI instance with the given font.
+ * Obtain the number of rows that were redrawn by the last call to
+ * ListUI_Render, and whether the next call will redraw everything.
+ **/
+void ListUI_GetDamageStats(SDL_ListUI* l, int* rows, SDL_bool* full);
+
+
+/**
+ * Check if a ListUI instance has changed since it was last rendered, e.g.,
+ * because items were added, labels changed, or the cursor moved.
+ **/
+SDL_bool ListUI_IsDirty(SDL_ListUI* l);
+
+
+/**
+ * Mark a ListUI instance as changed, forcing it to be rendered again from
+ * scratch.
+ **/
+void ListUI_Invalidate(SDL_ListUI* l);
+
+
+/**
+ * Render a ListUI instance with the given font. Rows are drawn into a
+ * persistent render target, and only rows that changed since the last
+ * call are redrawn. The target covers the entire output of the renderer.
  **/
 void ListUI_Render(SDL_ListUI* l, SDL_Renderer* renderer, TTF_Font* font);
 
 
+/**
+ * Lay out a ListUI instance for output of the given height with the given
+ * font, and publish a snapshot of it for ListUI_RenderSnapshot, replacing
+ * any snapshot that has not been rendered yet. The stamp is an opaque value,
+ * e.g., the time of the oldest input that the snapshot reflects; the oldest
+ * stamp is kept when snapshots replace each other.
+ **/
+void ListUI_Publish(SDL_ListUI* l, int h, TTF_Font* font, Uint64 stamp);
+
+
+/**
+ * Add a slice of the items to the trigram index of the filter, and return
+ * SDL_TRUE while items are left to index. Until the index is complete, the
+ * filter scans all items instead, so building it does not make the list
+ * dirty. Meant to be called while the mutating thread is idle, at most once
+ * per frame.
+ **/
+SDL_bool ListUI_BuildIndex(SDL_ListUI* l);
+
+
+/**
+ * Render the latest snapshot published with ListUI_Publish, like
+ * ListUI_Render. Returns the number of rows that still wait for text from
+ * the background rasterizer, in which case the function should be called
+ * again, or -1 if nothing was published since the last call.
+ **/
+int ListUI_RenderSnapshot(SDL_ListUI* l, SDL_Renderer* renderer,
+			  TTF_Font* font);
+
+
+/**
+ * Obtain the stamp of the snapshot drawn by the last call to
+ * ListUI_RenderSnapshot, or 0 if that call drew no new snapshot.
+ **/
+Uint64 ListUI_GetSnapshotStamp(SDL_ListUI* l);
+
+
 /* Local Variables: */
 /* tab-width: 8 */
 /* c-basic-offset: 4 */
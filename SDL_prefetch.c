@@ -0,0 +1,275 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#include "SDL_prefetch.h"
+
+
+#define PREFETCH_QUEUE_SIZE  256 // must be a power of two
+#define PREFETCH_FILTER_SIZE 512 // must be a power of two
+
+
+/**
+ * A ring buffer with a single producer and a single consumer. The producer
+ * fills a slot before it publishes it by advancing the tail, and the
+ * consumer copies a slot before it hands it back by advancing the head.
+ **/
+typedef struct Prefetch_Queue
+{
+    Prefetch_Job jobs[PREFETCH_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} Prefetch_Queue;
+
+
+struct SDL_Prefetch
+{
+    TTF_Font     *font;
+    SDL_Thread   *thread;
+    SDL_sem      *wakeup;
+    SDL_atomic_t  quit;
+
+    Prefetch_Queue requests; // produced by the caller, consumed by the worker
+    Prefetch_Queue results;  // produced by the worker, consumed by the caller
+
+    // Keys of pending requests, so that they are not queued twice. Only
+    // accessed by the caller.
+    Uint32 pending[PREFETCH_FILTER_SIZE];
+
+    Prefetch_Stats stats;
+};
+
+
+static SDL_bool Prefetch_Push(Prefetch_Queue* q, const Prefetch_Job* job)
+{
+    unsigned tail = (unsigned)SDL_AtomicGet(&q->tail);
+    unsigned head = (unsigned)SDL_AtomicGet(&q->head);
+
+    if(tail - head >= PREFETCH_QUEUE_SIZE) {
+	return SDL_FALSE;
+    }
+
+    q->jobs[tail & (PREFETCH_QUEUE_SIZE - 1)] = *job;
+    SDL_AtomicSet(&q->tail, (int)(tail + 1));
+
+    return SDL_TRUE;
+}
+
+
+static SDL_bool Prefetch_Pop(Prefetch_Queue* q, Prefetch_Job* job)
+{
+    unsigned head = (unsigned)SDL_AtomicGet(&q->head);
+    unsigned tail = (unsigned)SDL_AtomicGet(&q->tail);
+
+    if(head == tail) {
+	return SDL_FALSE;
+    }
+
+    *job = q->jobs[head & (PREFETCH_QUEUE_SIZE - 1)];
+    SDL_AtomicSet(&q->head, (int)(head + 1));
+
+    return SDL_TRUE;
+}
+
+
+static int Prefetch_Run(void* ctx)
+{
+    SDL_Color white = {0xff, 0xff, 0xff, 0xff};
+    int minx, maxx, miny, maxy;
+    SDL_Prefetch* p = ctx;
+    Prefetch_Job job;
+
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    while(!SDL_AtomicGet(&p->quit)) {
+	SDL_SemWait(p->wakeup);
+	while(!SDL_AtomicGet(&p->quit) && Prefetch_Pop(&p->requests, &job)) {
+	    if(job.kind == PREFETCH_TEXT) {
+		job.surface = TTF_RenderUTF8_Solid(p->font, job.text, job.color);
+	    } else {
+		if(TTF_GlyphMetrics32(p->font, job.codepoint, &minx, &maxx,
+				      &miny, &maxy, &job.advance)) {
+		    job.advance = 0;
+		}
+		job.surface = TTF_RenderGlyph32_Blended(p->font, job.codepoint,
+							white);
+	    }
+
+	    // There are never more jobs in flight than fit in the queue
+	    Prefetch_Push(&p->results, &job);
+	}
+    }
+
+    return 0;
+}
+
+
+SDL_Prefetch* Prefetch_Create(const char* font_path, int ptsize)
+{
+    SDL_Prefetch* p = SDL_calloc(1, sizeof(SDL_Prefetch));
+
+    if(!p) {
+	return 0;
+    }
+
+    // Faces are opened and closed by the caller, FreeType only allows
+    // distinct faces to be used concurrently
+    if(!(p->font=TTF_OpenFont(font_path, ptsize))) {
+	SDL_free(p);
+	return 0;
+    }
+    if(!(p->wakeup=SDL_CreateSemaphore(0))) {
+	TTF_CloseFont(p->font);
+	SDL_free(p);
+	return 0;
+    }
+    if(!(p->thread=SDL_CreateThread(Prefetch_Run, "Prefetch", p))) {
+	SDL_DestroySemaphore(p->wakeup);
+	TTF_CloseFont(p->font);
+	SDL_free(p);
+	return 0;
+    }
+
+    return p;
+}
+
+
+void Prefetch_Destroy(SDL_Prefetch* p)
+{
+    Prefetch_Job job;
+
+    SDL_AtomicSet(&p->quit, 1);
+    SDL_SemPost(p->wakeup);
+    SDL_WaitThread(p->thread, 0);
+
+    while(Prefetch_Pop(&p->requests, &job)) {
+	Prefetch_Release(&job);
+    }
+    while(Prefetch_Pop(&p->results, &job)) {
+	Prefetch_Release(&job);
+    }
+
+    SDL_DestroySemaphore(p->wakeup);
+    TTF_CloseFont(p->font);
+    SDL_free(p);
+}
+
+
+/**
+ * Queue a job, unless a job with the same key is already pending.
+ **/
+static int Prefetch_Request(SDL_Prefetch* p, Prefetch_Job* job)
+{
+    Uint32* slot = &p->pending[job->key & (PREFETCH_FILTER_SIZE - 1)];
+
+    if(*slot == job->key) {
+	return 0;
+    }
+    if(p->stats.inflight >= PREFETCH_QUEUE_SIZE ||
+       !Prefetch_Push(&p->requests, job)) {
+	p->stats.rejected++;
+	return -1;
+    }
+
+    *slot = job->key;
+    p->stats.requests++;
+    p->stats.inflight++;
+    SDL_SemPost(p->wakeup);
+
+    return 0;
+}
+
+
+int Prefetch_RequestGlyph(SDL_Prefetch* p, Uint32 codepoint)
+{
+    Prefetch_Job job = {0};
+
+    job.kind = PREFETCH_GLYPH;
+    job.codepoint = codepoint;
+    job.key = (codepoint * 2654435761U) | 1;
+
+    return Prefetch_Request(p, &job);
+}
+
+
+int Prefetch_RequestText(SDL_Prefetch* p, const char* text, SDL_Color color)
+{
+    Prefetch_Job job = {0};
+    Uint32 hash = 2166136261U;
+
+    for(const char* s=text; *s; s++) {
+	hash = (hash ^ (Uint8)*s) * 16777619U;
+    }
+    hash = (hash ^ color.r) * 16777619U;
+    hash = (hash ^ color.g) * 16777619U;
+    hash = (hash ^ color.b) * 16777619U;
+    hash = (hash ^ color.a) * 16777619U;
+
+    job.kind = PREFETCH_TEXT;
+    job.key = hash | 1;
+    job.color = color;
+    if(p->pending[job.key & (PREFETCH_FILTER_SIZE - 1)] == job.key) {
+	return 0;
+    }
+    if(!(job.text=SDL_strdup(text))) {
+	return -1;
+    }
+    if(Prefetch_Request(p, &job)) {
+	SDL_free(job.text);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+SDL_bool Prefetch_Poll(SDL_Prefetch* p, Prefetch_Job* job)
+{
+    Uint32* slot;
+
+    if(!Prefetch_Pop(&p->results, job)) {
+	return SDL_FALSE;
+    }
+
+    slot = &p->pending[job->key & (PREFETCH_FILTER_SIZE - 1)];
+    if(*slot == job->key) {
+	*slot = 0;
+    }
+    p->stats.completed++;
+    p->stats.inflight--;
+
+    return SDL_TRUE;
+}
+
+
+void Prefetch_Release(Prefetch_Job* job)
+{
+    SDL_FreeSurface(job->surface);
+    SDL_free(job->text);
+    job->surface = 0;
+    job->text = 0;
+}
+
+
+void Prefetch_GetStats(SDL_Prefetch* p, Prefetch_Stats* stats)
+{
+    *stats = p->stats;
+}
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
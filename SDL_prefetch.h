@@ -0,0 +1,124 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+/**
+ * Prefetch rasterizes glyphs and text on a background thread, so that the
+ * thread that renders never has to wait for FreeType. Requests and finished
+ * surfaces are handed between the two threads through single-producer,
+ * single-consumer ring buffers without locks. All functions are called by
+ * the thread that renders, e.g.,
+ *
+ *  Prefetch_RequestText(p, "Item 1", color);
+ *  ...
+ *  while(Prefetch_Poll(p, &job)) {
+ *      // upload job.surface
+ *      Prefetch_Release(&job);
+ *  }
+ **/
+struct SDL_Prefetch;
+typedef struct SDL_Prefetch SDL_Prefetch;
+
+
+typedef enum Prefetch_Kind
+{
+    PREFETCH_GLYPH, // a glyph rendered with TTF_RenderGlyph32_Blended in white
+    PREFETCH_TEXT,  // text rendered with TTF_RenderUTF8_Solid
+} Prefetch_Kind;
+
+
+/**
+ * A rasterization request, and its result once it has been polled.
+ **/
+typedef struct Prefetch_Job
+{
+    Prefetch_Kind kind;
+    Uint32        key;
+    Uint32        codepoint;
+    char         *text;
+    SDL_Color     color;
+    SDL_Surface  *surface; // NULL if rasterization failed
+    int           advance; // horizontal advance of a glyph, in pixels
+} Prefetch_Job;
+
+
+/**
+ * Statistics gathered by a Prefetch instance.
+ **/
+typedef struct Prefetch_Stats
+{
+    Uint64 requests;  // requests handed to the worker
+    Uint64 completed; // results polled from the worker
+    Uint64 rejected;  // requests dropped because the queue was full
+    int    inflight;  // requests that have not been polled yet
+} Prefetch_Stats;
+
+
+/**
+ * Start a worker thread that rasterizes with its own instance of the font
+ * at the given path and size.
+ **/
+SDL_Prefetch* Prefetch_Create(const char* font_path, int ptsize);
+
+
+/**
+ * Stop the worker thread, and free all memory associated with a Prefetch
+ * instance.
+ **/
+void Prefetch_Destroy(SDL_Prefetch* p);
+
+
+/**
+ * Request a glyph to be rasterized. Returns 0 if the request was queued or
+ * is already pending, and -1 if the queue is full.
+ **/
+int Prefetch_RequestGlyph(SDL_Prefetch* p, Uint32 codepoint);
+
+
+/**
+ * Request text to be rasterized in the given color. Returns 0 if the request
+ * was queued or is already pending, and -1 if the queue is full.
+ **/
+int Prefetch_RequestText(SDL_Prefetch* p, const char* text, SDL_Color color);
+
+
+/**
+ * Obtain the next finished job, if any. The job must be released with
+ * Prefetch_Release.
+ **/
+SDL_bool Prefetch_Poll(SDL_Prefetch* p, Prefetch_Job* job);
+
+
+/**
+ * Free the text and surface of a polled job.
+ **/
+void Prefetch_Release(Prefetch_Job* job);
+
+
+/**
+ * Obtain statistics gathered by a Prefetch instance.
+ **/
+void Prefetch_GetStats(SDL_Prefetch* p, Prefetch_Stats* stats);
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
@@ -18,8 +18,10 @@ along with this program; see the file COPYING. If not, see
 #include <SDL2/SDL_ttf.h>
 
 #include "IME_dialog.h"
+#include "SDL_compose.h"
 #include "SDL_listui.h"
 #include "offact.h"
+#include "offact_worker.h"
 
 #include "readme.h"
 
@@ -27,56 +29,165 @@ along with this program; see the file COPYING. If not, see
 #define WINDOW_TITLE  "OffAct"
 #define SCREEN_WIDTH  1920
 #define SCREEN_HEIGHT 1080
+#define FONT_PATH     "/preinst/common/font/n023055ms.ttf"
+#define FONT_SIZE     44
+
+#define FRAME_RATE_MAX 60   // frames per second
+#define IDLE_TIMEOUT   1000 // milliseconds between wakeups when idle
+#define IME_HEARTBEAT  100  // milliseconds between IME status polls
+
+#define PREFETCH_ROWS 16    // rows rasterized ahead of scrolling
+
+#define WATCH_INTERVAL_MIN 500   // milliseconds between polls after a change
+#define WATCH_INTERVAL_MAX 8000  // milliseconds between polls when unchanged
+
+#define REPEAT_DELAY    300   // milliseconds before held input repeats
+#define REPEAT_INTERVAL 100   // milliseconds between the first repeats
+#define REPEAT_MIN      16    // milliseconds between repeats at full speed
+#define REPEAT_ACCEL    1000  // milliseconds held before repeats speed up
+#define STICK_DEADZONE  8000  // stick deflection that is ignored
+#define TRIGGER_PRESS   16000 // trigger deflection that counts as a press
+
+#define ITEM_COLUMNS  4     // type, flags, id and name
+#define ITEM_CELL_MAX 64
+#define ITEM_COLUMN_NAME 3  // column that the filter applies to
+
+#define ACTIVATE_TYPE  "np" // account type of activated accounts
+#define ACTIVATE_FLAGS 4098 // account flags of activated accounts
+
+
+/**
+ * State shared with the thread that renders the list.
+ **/
+typedef struct RenderContext
+{
+    SDL_Renderer *renderer;
+    TTF_Font     *font;
+    SDL_sem      *wakeup;
+    SDL_atomic_t  quit;
+} RenderContext;
 
 
 static SDL_ListUI *ui;
+static int frame_rate_max = FRAME_RATE_MAX;
+static char filter_query[ITEM_CELL_MAX];
+static SDL_bool indexing; // the filter index may have items left to index
+
+// Time from when input is dequeued until a frame that reflects it is
+// presented, in performance counter ticks
+static struct {
+    Uint64 count;
+    Uint64 total;
+    Uint64 max;
+} latency;
+
+// Held input and cursor moves that are applied once per frame
+static struct {
+    int      dpad;       // direction of the held D-pad button, or 0
+    Uint32   dpad_since; // when the D-pad button was pressed
+    Uint32   dpad_next;  // when the D-pad button repeats next
+    int      stick;      // deflection of the left stick, or 0
+    Uint32   stick_next; // when the stick repeats next
+    SDL_bool trigger[2]; // whether L2 and R2 are pressed
+    int      steps;      // rows to move the cursor by
+    SDL_bool wrap;       // whether the steps may wrap around the list
+    SDL_bool moved;      // whether the cursor was moved silently
+} input;
+
+// Account whose id is being entered in the IME dialog, and the number of
+// activations and registry writes they issued
+static struct {
+    int    numb;
+    Uint64 item_id;
+    Uint64 count;
+    Uint64 writes;
+} activation;
+
+// Accounts as last reported by the registry worker, and the number of
+// writes in flight for each of them
+static OffAct_AccountTable accounts;
+static int pending_writes[ACCOUNT_NUMB_MAX];
+
+// Changes applied to the list when it is refreshed, accounts changed by
+// others, and the time spent taking snapshots, in microseconds
+static struct {
+    Uint64 count;
+    Uint64 ops;
+    Uint64 changes;
+    Uint64 snapshots;
+    Uint64 read_us;
+    Uint64 read_max_us;
+} refreshes;
 
 
 static void refreshListUI(void);
 
 
 /**
- * Obtain a textual label for an account with the given number.
+ * Format the text of each column in the list for an account, i.e., type,
+ * flags, id and name. Accounts with writes in flight show as pending.
  **/
-static int GetItemLabel(int account_numb, char* label, size_t size)
+static void GetItemCells(const OffAct_Account* a, char cells[][ITEM_CELL_MAX])
 {
-    char account_name[ACCOUNT_NAME_MAX];
-    char account_type[ACCOUNT_TYPE_MAX];
-    Uint64 account_id;
-    int account_flags;
+    SDL_snprintf(cells[0], ITEM_CELL_MAX, "%s", a->type);
+    SDL_snprintf(cells[1], ITEM_CELL_MAX, "0x%04x", a->flags);
+    SDL_snprintf(cells[2], ITEM_CELL_MAX, "0x%016lx", a->id);
+    SDL_snprintf(cells[3], ITEM_CELL_MAX, "%s", a->name);
 
-    if(OffAct_GetAccountName(account_numb, account_name)) {
-	return -1;
-    }
-    if(!*account_name) {
-	return -1;
+    if(pending_writes[a->numb - 1]) {
+	SDL_snprintf(cells[1], ITEM_CELL_MAX, "...");
     }
-    if(OffAct_GetAccountId(account_numb, &account_id)) {
-	return -1;
+}
+
+
+/**
+ * Find the last known state of an account with the given number.
+ **/
+static OffAct_Account* FindAccount(int account_numb)
+{
+    for(int i=0; i<accounts.nb_accounts; i++) {
+	if(accounts.accounts[i].numb == account_numb) {
+	    return &accounts.accounts[i];
+	}
     }
-    if(OffAct_GetAccountType(account_numb, account_type)) {
-	return -1;
+
+    return 0;
+}
+
+
+/**
+ * Update the row of an account that changed, without touching the other
+ * rows. Falls back to a full refresh if the account is not in the list.
+ **/
+static void UpdateAccountItem(Uint64 item_id, const OffAct_Account* a)
+{
+    char cells[ITEM_COLUMNS][ITEM_CELL_MAX];
+    OffAct_Account* known = FindAccount(a->numb);
+
+    if(!known) {
+	refreshListUI();
+	return;
     }
-    if(OffAct_GetAccountFlags(account_numb, &account_flags)) {
-	return -1;
+    if(known != a) {
+	*known = *a;
     }
 
-    SDL_snprintf(label, size, "type: ""%2s  "		\
-		 "flags: 0x%04x  id: 0x%016lx  name: %s",
-		 account_type, account_flags, account_id, account_name);
-
-    return 0;
+    GetItemCells(a, cells);
+    for(int i=0; i<ITEM_COLUMNS; i++) {
+	if(!ListUI_SetItemCell(ui, item_id, i, cells[i])) {
+	    refreshListUI();
+	    return;
+	}
+    }
 }
 
 
 static void OnDialogOutcome(void* ctx, IME_Dialog_Outcome outcome) {
-    char account_type[ACCOUNT_TYPE_MAX] = "np";
-    int account_numb = (int)(Uint64)ctx;
-    int account_flags = 4098;
+    OffAct_Account* a = FindAccount(activation.numb);
     Uint64 account_id;
     char buf[255];
 
-    if(outcome != IME_DIALOG_COMPLETED) {
+    if(outcome != IME_DIALOG_COMPLETED || !a) {
 	return;
     }
     if(IME_Dialog_GetText(buf, sizeof(buf)) < 0) {
@@ -86,11 +197,16 @@ static void OnDialogOutcome(void* ctx, IME_Dialog_Outcome outcome) {
 	return;
     }
 
-    OffAct_SetAccountId(account_numb, account_id);
-    OffAct_SetAccountType(account_numb, account_type);
-    OffAct_SetAccountFlags(account_numb, account_flags);
+    if(OffAct_QueueApply(activation.numb, account_id, ACTIVATE_TYPE,
+			 ACTIVATE_FLAGS, (void*)activation.item_id)) {
+	printf("OffAct_QueueApply: unable to activate account %d\n",
+	       activation.numb);
+	return;
+    }
 
-    refreshListUI();
+    // The row shows as pending until the worker reports back
+    pending_writes[activation.numb - 1]++;
+    UpdateAccountItem(activation.item_id, a);
 }
 
 
@@ -100,20 +216,19 @@ static void OnDialogOutcome(void* ctx, IME_Dialog_Outcome outcome) {
 static void OnActivateItem(void *ctx, SDL_ListUI *listui, Uint64 item_id)
 {
     int account_numb = (int)(Uint64)ctx;
-    char account_name[ACCOUNT_NAME_MAX];
+    OffAct_Account* a = FindAccount(account_numb);
     Uint64 account_id;
     char buf[255];
 
-    if(OffAct_GetAccountName(account_numb, account_name)) {
-	return;
-    }
-    if(OffAct_GetAccountId(account_numb, &account_id)) {
+    if(!a) {
 	return;
     }
+
+    account_id = a->id;
     if(!account_id) {
-	account_id = OffAct_GenAccountId(account_name);
+	account_id = OffAct_GenAccountId(a->name);
     }
-    sprintf(buf, "Enter account ID for %s", account_name);
+    sprintf(buf, "Enter account ID for %s", a->name);
     if(IME_Dialog_SetTitle(buf) < 0) {
 	return;
     }
@@ -122,26 +237,662 @@ static void OnActivateItem(void *ctx, SDL_ListUI *listui, Uint64 item_id)
 	return;
     }
 
-    IME_Dialog_OnOutcome(OnDialogOutcome, (void*)(Uint64)account_numb);
+    activation.numb = account_numb;
+    activation.item_id = item_id;
+    IME_Dialog_OnOutcome(OnDialogOutcome, 0);
+    if(IME_Dialog_Display(SCREEN_WIDTH/2, SCREEN_HEIGHT/2)) {
+	return;
+    }
+}
+
+
+static void OnFilterOutcome(void* ctx, IME_Dialog_Outcome outcome) {
+    if(outcome != IME_DIALOG_COMPLETED) {
+	return;
+    }
+    if(IME_Dialog_GetText(filter_query, sizeof(filter_query)) < 0) {
+	return;
+    }
+
+    ListUI_SetFilter(ui, filter_query, ITEM_COLUMN_NAME,
+		     LISTUI_FILTER_SUBSTRING);
+}
+
+
+/**
+ * Bring up the IME dialog for a query that narrows the list to accounts
+ * with matching names. An empty query shows all accounts again.
+ **/
+static void ShowFilterDialog(void)
+{
+    if(IME_Dialog_SetTitle("Filter accounts by name") < 0) {
+	return;
+    }
+    if(IME_Dialog_SetText(filter_query) < 0) {
+	return;
+    }
+
+    IME_Dialog_OnOutcome(OnFilterOutcome, 0);
     if(IME_Dialog_Display(SCREEN_WIDTH/2, SCREEN_HEIGHT/2)) {
 	return;
     }
 }
 
 
+/**
+ * Update the list with the last known state of the accounts. Accounts are
+ * keyed on their number, so that only those that changed are redrawn, and
+ * the selection stays with the same account.
+ **/
+static void ReconcileAccounts(void)
+{
+    char cells[ACCOUNT_NUMB_MAX][ITEM_COLUMNS][ITEM_CELL_MAX];
+    ListUI_ItemData items[ACCOUNT_NUMB_MAX];
+    const OffAct_Account* a;
+    int ops;
+
+    for(int i=0; i<accounts.nb_accounts; i++) {
+	a = &accounts.accounts[i];
+	GetItemCells(a, cells[i]);
+
+	SDL_memset(&items[i], 0, sizeof(ListUI_ItemData));
+	items[i].key = a->numb;
+	for(int j=0; j<ITEM_COLUMNS; j++) {
+	    items[i].cells[j] = cells[i][j];
+	}
+	items[i].nb_cells = ITEM_COLUMNS;
+	items[i].on_activate = OnActivateItem;
+	items[i].ctx = (void*)(Uint64)a->numb;
+    }
+
+    if((ops=ListUI_Reconcile(ui, items, accounts.nb_accounts)) >= 0) {
+	refreshes.count++;
+	refreshes.ops += ops;
+    }
+}
+
+
+/**
+ * Update the list with a snapshot of the accounts.
+ **/
+static void ApplySnapshot(const OffAct_AccountTable* table)
+{
+    accounts = *table;
+    ReconcileAccounts();
+
+    refreshes.snapshots++;
+    refreshes.read_us += table->timing.total_us;
+    refreshes.read_max_us = SDL_max(refreshes.read_max_us,
+				    table->timing.total_us);
+}
+
+
+/**
+ * Update the list with an account that was changed by someone else, and
+ * that is empty now unless populated is set. Accounts stay ordered by
+ * their number.
+ **/
+static void ApplyChange(const OffAct_Account* a, SDL_bool populated)
+{
+    OffAct_Account* table = accounts.accounts;
+    int nb = accounts.nb_accounts;
+    int i = 0;
+
+    while(i < nb && table[i].numb < a->numb) {
+	i++;
+    }
+
+    if(i < nb && table[i].numb == a->numb) {
+	if(populated) {
+	    table[i] = *a;
+	} else {
+	    SDL_memmove(&table[i], &table[i + 1],
+			(nb - i - 1) * sizeof(OffAct_Account));
+	    accounts.nb_accounts--;
+	    accounts.populated &= ~(1U << (a->numb - 1));
+	}
+    } else if(populated) {
+	SDL_memmove(&table[i + 1], &table[i],
+		    (nb - i) * sizeof(OffAct_Account));
+	table[i] = *a;
+	accounts.nb_accounts++;
+	accounts.populated |= 1U << (a->numb - 1);
+    }
+
+    refreshes.changes++;
+    ReconcileAccounts();
+}
+
+
+/**
+ * Ask the registry worker for a snapshot of the accounts, which updates the
+ * list once it arrives.
+ **/
 static void refreshListUI(void) {
-    Uint64 item_id;
-    char buf[255];
+    if(OffAct_QueueSnapshot(0)) {
+	printf("OffAct_QueueSnapshot: unable to refresh accounts\n");
+    }
+}
+
+
+/**
+ * Activate all populated accounts at once. Every row shows as pending until
+ * the worker reports back.
+ **/
+static void ActivateAll(void)
+{
+    Uint32 marked = accounts.populated;
+
+    if(OffAct_QueueActivateAll(ACTIVATE_TYPE, ACTIVATE_FLAGS,
+			       (void*)(Uint64)marked)) {
+	printf("OffAct_QueueActivateAll: unable to activate accounts\n");
+	return;
+    }
+
+    for(int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
+	if(marked & (1U << (n - 1))) {
+	    pending_writes[n - 1]++;
+	}
+    }
+    ReconcileAccounts();
+}
+
+
+/**
+ * Log the outcome of activating all accounts, and update the list with the
+ * accounts as they were read back.
+ **/
+static void OnActivateAll(OffAct_Job* job)
+{
+    Uint32 marked = (Uint32)(Uint64)job->ctx;
+    const OffAct_BatchResult* r;
+
+    for(int i=0; i<job->result; i++) {
+	r = &job->results[i];
+	printf("activate: account %d, id 0x%016lx, %d writes, %s, %.3f ms\n",
+	       r->numb, r->id, r->writes, r->verified ? "failed" : "verified",
+	       r->us / 1000.0);
+	if(r->writes >= 0) {
+	    activation.count++;
+	    activation.writes += r->writes;
+	}
+    }
+
+    for(int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
+	if(marked & (1U << (n - 1))) {
+	    pending_writes[n - 1]--;
+	}
+    }
+    ApplySnapshot(&job->table);
+}
+
+
+/**
+ * Handle a job that the registry worker finished.
+ **/
+static void OnRegistryJob(OffAct_Job* job)
+{
+    Uint64 item_id = (Uint64)job->ctx;
+    int account_numb = job->account.numb;
+
+    switch(job->kind) {
+    case OFFACT_JOB_SNAPSHOT:
+	ApplySnapshot(&job->table);
+	break;
+
+    case OFFACT_JOB_CHANGE:
+	ApplyChange(&job->account, job->result == 0);
+	break;
+
+    case OFFACT_JOB_BATCH:
+	OnActivateAll(job);
+	break;
+
+    case OFFACT_JOB_APPLY:
+	pending_writes[account_numb - 1]--;
+	if(job->result == -2) {
+	    printf("OffAct_ApplyAccount: unable to activate account %d, "
+		   "and unable to restore it\n", account_numb);
+	} else if(job->result < 0) {
+	    printf("OffAct_ApplyAccount: unable to activate account %d\n",
+		   account_numb);
+	} else {
+	    activation.count++;
+	    activation.writes += job->result;
+	}
+
+	// The account as read back also clears the pending state
+	if(job->account.fields != OFFACT_FIELDS_ALL || !*job->account.name) {
+	    refreshListUI();
+	} else {
+	    UpdateAccountItem(item_id, &job->account);
+	}
+	break;
+    }
+
+    OffAct_ReleaseJob(job);
+}
+
+
+/**
+ * Count the repeats of held input that are due at the given time, and
+ * schedule the next one. Repeats that fell far behind, e.g., while the
+ * main loop was blocked, are dropped rather than applied in a burst.
+ **/
+static int Repeat(Uint32* next, Uint32 interval, Uint32 now)
+{
+    int n;
+
+    if(!SDL_TICKS_PASSED(now, *next)) {
+	return 0;
+    }
+    if(now - *next > REPEAT_DELAY) {
+	*next = now;
+    }
+
+    n = 1 + (now - *next) / interval;
+    *next += n * interval;
+
+    return n;
+}
+
+
+/**
+ * Compute the interval between repeats of the held D-pad button, which
+ * halves every REPEAT_ACCEL milliseconds, down to REPEAT_MIN.
+ **/
+static Uint32 GetDirectionInterval(Uint32 now)
+{
+    int shift = SDL_min((now - input.dpad_since) / REPEAT_ACCEL, 3);
 
-    ListUI_Clear(ui);
-    for (int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
-	*buf = 0;
-	if(GetItemLabel(n, buf, sizeof(buf)) < 0) {
+    return SDL_max(REPEAT_INTERVAL >> shift, REPEAT_MIN);
+}
+
+
+/**
+ * Compute the interval between repeats of the deflected stick, which is
+ * twice REPEAT_INTERVAL at the deadzone, and REPEAT_MIN at full deflection.
+ **/
+static Uint32 GetStickInterval(void)
+{
+    int range = SDL_JOYSTICK_AXIS_MAX - STICK_DEADZONE;
+    int over = SDL_min(SDL_abs(input.stick), SDL_JOYSTICK_AXIS_MAX) -
+	STICK_DEADZONE;
+
+    return REPEAT_MIN + (2 * REPEAT_INTERVAL - REPEAT_MIN) *
+	(range - over) / range;
+}
+
+
+/**
+ * Apply the cursor moves queued since the last frame as a single move, so
+ * that the selected item is only notified once per frame.
+ **/
+static void ApplyInput(Uint32 now)
+{
+    int n;
+
+    if(input.dpad &&
+       (n=Repeat(&input.dpad_next, GetDirectionInterval(now), now))) {
+	input.steps += n * input.dpad;
+	input.wrap = SDL_FALSE;
+    }
+    if(input.stick &&
+       (n=Repeat(&input.stick_next, GetStickInterval(), now))) {
+	input.steps += input.stick < 0 ? -n : n;
+	input.wrap = SDL_FALSE;
+    }
+
+    if(input.steps || input.moved) {
+	ListUI_NavigateBy(ui, input.steps, SDL_FALSE, input.wrap);
+	input.steps = 0;
+	input.moved = SDL_FALSE;
+    }
+}
+
+
+/**
+ * Compute how long until the given deadline, in milliseconds.
+ **/
+static int GetTimeUntil(Uint32 deadline, Uint32 now)
+{
+    return SDL_TICKS_PASSED(now, deadline) ? 0 : (int)(deadline - now);
+}
+
+
+/**
+ * Queue a one-row step of the cursor, and (re)start repeating it while the
+ * D-pad button is held.
+ **/
+static void PressDirection(int dir)
+{
+    input.dpad = dir;
+    input.dpad_since = SDL_GetTicks();
+    input.dpad_next = input.dpad_since + REPEAT_DELAY;
+    input.steps += dir;
+    input.wrap = SDL_TRUE;
+}
+
+
+/**
+ * Track the deflection of the left stick, which steps the cursor once when
+ * it leaves the deadzone, and then repeats at a rate that grows with the
+ * deflection.
+ **/
+static void MoveStick(int value)
+{
+    int stick = SDL_abs(value) < STICK_DEADZONE ? 0 : value;
+
+    if(stick && !input.stick) {
+	input.stick_next = SDL_GetTicks() + REPEAT_DELAY;
+	input.steps += stick < 0 ? -1 : 1;
+	input.wrap = SDL_FALSE;
+    }
+    input.stick = stick;
+}
+
+
+/**
+ * Jump to the top or bottom of the list when L2 or R2 is pulled past the
+ * press threshold. A trigger must be released halfway before it jumps again.
+ **/
+static void MoveTrigger(int trigger, int value)
+{
+    if(!input.trigger[trigger] && value >= TRIGGER_PRESS) {
+	input.trigger[trigger] = SDL_TRUE;
+	input.steps = 0;
+	input.moved = SDL_TRUE;
+	ListUI_NavigateToIndex(ui, trigger ? ListUI_GetItemCount(ui) - 1 : 0,
+			       SDL_TRUE);
+    } else if(value < TRIGGER_PRESS / 2) {
+	input.trigger[trigger] = SDL_FALSE;
+    }
+}
+
+
+/**
+ * Turn a page with L1 or R1. Steps queued before it are applied first, so
+ * the moves happen in the order they were made.
+ **/
+static void TurnPage(int dir)
+{
+    ListUI_NavigateBy(ui, input.steps, SDL_TRUE, input.wrap);
+    input.steps = 0;
+    input.moved = SDL_TRUE;
+
+    if(dir < 0) {
+	ListUI_NavigatePageUp(ui, SDL_TRUE, SDL_FALSE);
+    } else {
+	ListUI_NavigatePageDown(ui, SDL_TRUE, SDL_FALSE);
+    }
+}
+
+
+/**
+ * Dispatch an input event, and return non-zero if the user wants to quit.
+ * Cursor moves are queued, and applied by ApplyInput.
+ **/
+static int OnEvent(SDL_Event* event)
+{
+    if(event->type == OffAct_GetEventType()) {
+	OnRegistryJob(event->user.data1);
+	return 0;
+    }
+
+    switch(event->type) {
+    case SDL_CONTROLLERBUTTONDOWN:
+	break;
+
+    case SDL_CONTROLLERBUTTONUP:
+	if((event->cbutton.button == SDL_CONTROLLER_BUTTON_DPAD_UP &&
+	    input.dpad < 0) ||
+	   (event->cbutton.button == SDL_CONTROLLER_BUTTON_DPAD_DOWN &&
+	    input.dpad > 0)) {
+	    input.dpad = 0;
+	}
+	return 0;
+
+    case SDL_CONTROLLERAXISMOTION:
+	switch(event->caxis.axis) {
+	case SDL_CONTROLLER_AXIS_LEFTY:
+	    MoveStick(event->caxis.value);
+	    break;
+	case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
+	    MoveTrigger(0, event->caxis.value);
+	    break;
+	case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
+	    MoveTrigger(1, event->caxis.value);
+	    break;
+	}
+	return 0;
+
+    case SDL_CONTROLLERDEVICEREMOVED:
+	input.dpad = 0;
+	input.stick = 0;
+	input.trigger[0] = input.trigger[1] = SDL_FALSE;
+	return 0;
+
+    default:
+	return 0;
+    }
+
+    switch(event->cbutton.button) {
+    case SDL_CONTROLLER_BUTTON_DPAD_UP:
+	PressDirection(-1);
+	break;
+    case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+	PressDirection(1);
+	break;
+    case SDL_CONTROLLER_BUTTON_LEFTSHOULDER:
+	TurnPage(-1);
+	break;
+    case SDL_CONTROLLER_BUTTON_RIGHTSHOULDER:
+	TurnPage(1);
+	break;
+    case SDL_CONTROLLER_BUTTON_A:
+	ApplyInput(SDL_GetTicks());
+	ListUI_ActivateSelected(ui);
+	break;
+    case SDL_CONTROLLER_BUTTON_X:
+	ActivateAll();
+	break;
+    case SDL_CONTROLLER_BUTTON_Y:
+	ShowFilterDialog();
+	break;
+    case SDL_CONTROLLER_BUTTON_B:
+	return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Compute how long the main loop may sleep while waiting for events.
+ **/
+static int GetWaitTimeout(Uint32 last_frame)
+{
+    Uint32 frame_interval = 1000 / frame_rate_max;
+    Uint32 now = SDL_GetTicks();
+    Uint32 elapsed = now - last_frame;
+    int timeout = IDLE_TIMEOUT;
+
+    // A frame is pending, wake up when the frame cap allows it
+    if(ListUI_IsDirty(ui)) {
+	return elapsed >= frame_interval ? 0 : frame_interval - elapsed;
+    }
+
+    // The IME dialog is only observable by polling its status
+    if(IME_Dialog_IsRunning()) {
+	timeout = IME_HEARTBEAT;
+    }
+
+    // The filter index is built a slice at a time, at most once per frame
+    if(indexing) {
+	timeout = SDL_min(timeout, (int)frame_interval);
+    }
+
+    // Held input repeats without generating events
+    if(input.dpad) {
+	timeout = SDL_min(timeout, GetTimeUntil(input.dpad_next, now));
+    }
+    if(input.stick) {
+	timeout = SDL_min(timeout, GetTimeUntil(input.stick_next, now));
+    }
+
+    return timeout;
+}
+
+
+/**
+ * Compare the frame time of the render paths on the current list, both for
+ * full redraws and for one-step cursor moves.
+ **/
+static void RunBenchmark(SDL_Renderer* renderer, TTF_Font* font, int frames)
+{
+    static const struct {
+	const char* name;
+	ListUI_RenderPath path;
+    } paths[] = {
+	{"geometry",   LISTUI_RENDER_GEOMETRY},
+	{"compositor", LISTUI_RENDER_COMPOSITOR},
+    };
+    double freq = SDL_GetPerformanceFrequency() / 1000.0;
+    Uint64 full, step, t;
+
+    for(int i=0; i<SDL_arraysize(paths); i++) {
+	ListUI_SetRenderPath(ui, paths[i].path);
+	ListUI_Render(ui, renderer, font);
+	SDL_RenderFlush(renderer);
+
+	full = step = 0;
+	for(int n=0; n<frames; n++) {
+	    ListUI_Invalidate(ui);
+	    t = SDL_GetPerformanceCounter();
+	    ListUI_Render(ui, renderer, font);
+	    SDL_RenderFlush(renderer);
+	    full += SDL_GetPerformanceCounter() - t;
+
+	    if(n & 1) {
+		ListUI_NavigateItemUp(ui, SDL_TRUE, SDL_TRUE);
+	    } else {
+		ListUI_NavigateItemDown(ui, SDL_TRUE, SDL_TRUE);
+	    }
+	    t = SDL_GetPerformanceCounter();
+	    ListUI_Render(ui, renderer, font);
+	    SDL_RenderFlush(renderer);
+	    step += SDL_GetPerformanceCounter() - t;
+	}
+
+	printf("bench: %-10s full redraw %.3f ms, one-step move %.3f ms "
+	       "(%d frames, %s spans)\n", paths[i].name,
+	       full / freq / frames, step / freq / frames, frames,
+	       Compose_GetBackend());
+    }
+}
+
+
+static void RecordLatency(Uint64 stamp)
+{
+    Uint64 ticks;
+
+    if(!stamp) {
+	return;
+    }
+
+    ticks = SDL_GetPerformanceCounter() - stamp;
+    latency.count++;
+    latency.total += ticks;
+    latency.max = SDL_max(latency.max, ticks);
+}
+
+
+/**
+ * Draw snapshots of the list published by the main thread, so that input
+ * handling never waits for vsync. The software renderer has no thread
+ * affinity, so it is created by the main thread and only used here while
+ * this thread runs.
+ **/
+static int RenderThread(void* ctx)
+{
+    Uint32 frame_interval = 1000 / frame_rate_max;
+    RenderContext* rc = ctx;
+    Uint32 last_frame = 0;
+    Uint32 elapsed;
+    int pending = -1;
+
+    while(!SDL_AtomicGet(&rc->quit)) {
+	// Sleep until a snapshot is published, unless text is still missing
+	if(pending <= 0) {
+	    SDL_SemWaitTimeout(rc->wakeup, IDLE_TIMEOUT);
+	}
+
+	elapsed = SDL_GetTicks() - last_frame;
+	if(elapsed < frame_interval) {
+	    SDL_Delay(frame_interval - elapsed);
+	}
+
+	if((pending=ListUI_RenderSnapshot(ui, rc->renderer, rc->font)) < 0) {
 	    continue;
 	}
 
-	item_id = ListUI_AppendItem(ui, buf);
-	ListUI_OnActivate(ui, item_id, OnActivateItem, (void*)(Uint64)n);
+	SDL_RenderPresent(rc->renderer);
+	last_frame = SDL_GetTicks();
+	RecordLatency(ListUI_GetSnapshotStamp(ui));
+    }
+
+    return 0;
+}
+
+
+/**
+ * Log statistics gathered by the text renderers.
+ **/
+static void LogRenderStats(void)
+{
+    Prefetch_Stats prefetch;
+    GlyphAtlas_Stats stats;
+    size_t high_water, reserved;
+    Uint64 hits, misses;
+    size_t size;
+
+    ListUI_GetAtlasStats(ui, &stats);
+    printf("atlas: %d glyphs, %dx%d (%d%% occupied), %lu hits, %lu misses, "
+	   "%lu quads in %lu batches\n", stats.glyphs, stats.width,
+	   stats.height, stats.occupancy, stats.hits, stats.misses,
+	   stats.quads, stats.batches);
+
+    ListUI_GetCacheStats(ui, &size, &hits, &misses);
+    printf("textures: %zu bytes, %lu hits, %lu misses\n", size, hits, misses);
+
+    ListUI_GetMemoryStats(ui, &size, &high_water, &reserved);
+    printf("items: %zu bytes, %zu bytes at most, %zu bytes reserved\n",
+	   size, high_water, reserved);
+
+    ListUI_GetPrefetchStats(ui, &prefetch);
+    printf("prefetch: %lu requests, %lu completed, %lu rejected\n",
+	   prefetch.requests, prefetch.completed, prefetch.rejected);
+
+    printf("refresh: %lu refreshes, %lu changes\n", refreshes.count,
+	   refreshes.ops);
+    if(refreshes.snapshots) {
+	printf("registry: %.3f ms average, %.3f ms max per snapshot\n",
+	       refreshes.read_us / 1000.0 / refreshes.snapshots,
+	       refreshes.read_max_us / 1000.0);
+    }
+    printf("watch: %lu accounts changed by others\n", refreshes.changes);
+
+    printf("activation: %lu activations, %lu registry writes\n",
+	   activation.count, activation.writes);
+
+    OffAct_GetCacheStats(&hits, &misses);
+    printf("registry cache: %lu hits, %lu misses\n", hits, misses);
+
+    if(latency.count) {
+	printf("latency: %lu inputs, %.3f ms average, %.3f ms max\n",
+	       latency.count, latency.total * 1000.0 / latency.count /
+	       SDL_GetPerformanceFrequency(),
+	       latency.max * 1000.0 / SDL_GetPerformanceFrequency());
     }
 }
 
@@ -152,12 +903,33 @@ int SDL_main(int argc, char* args[])
     SDL_Window* window;
     SDL_Event event;
     TTF_Font* font;
+    ListUI_RenderPath path = LISTUI_RENDER_GEOMETRY;
+    SDL_Thread* render_thread = 0;
+    RenderContext rc = {0};
+    OffAct_AccountTable table;
+    SDL_bool threaded = SDL_TRUE;
+    Uint32 last_frame = 0;
+    Uint64 stamp = 0;
+    int bench = 0;
     int quit = 0;
+    int w, h;
 
     printf("%s\n", README_md);
     printf("%s %s was compiled at %s %s\n",
            WINDOW_TITLE, VERSION_TAG, __DATE__, __TIME__);
 
+    for(int i=1; i<argc; i++) {
+	if(!SDL_strncmp(args[i], "--fps=", 6)) {
+	    frame_rate_max = SDL_max(1, SDL_atoi(args[i] + 6));
+	} else if(!SDL_strcmp(args[i], "--compositor")) {
+	    path = LISTUI_RENDER_COMPOSITOR;
+	} else if(!SDL_strncmp(args[i], "--bench=", 8)) {
+	    bench = SDL_max(1, SDL_atoi(args[i] + 8));
+	} else if(!SDL_strcmp(args[i], "--single-thread")) {
+	    threaded = SDL_FALSE;
+	}
+    }
+
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) < 0) {
         printf("SDL_Init: %s\n", SDL_GetError());
 	return -1;
@@ -182,46 +954,107 @@ int SDL_main(int argc, char* args[])
         printf("TTF_Init: %s\n", TTF_GetError());
 	return -1;
     }
-    if(!(font=TTF_OpenFont("/preinst/common/font/n023055ms.ttf", 44))) {
+    if(!(font=TTF_OpenFont(FONT_PATH, FONT_SIZE))) {
         printf("TTF_OpenFont: %s\n", TTF_GetError());
         return 1;
     }
 
     ui = ListUI_Create("Offline account activation");
+    ListUI_SetAtlasCache(ui, ".", FONT_PATH, FONT_SIZE);
     ListUI_SetSelectedColor(ui, (SDL_Color){0x3b, 0x40, 0x47, 0xff});
     ListUI_SetTextColor(ui, (SDL_Color){0xb9, 0xbb, 0xbb, 0xff});
     ListUI_SetActivateTextColor(ui, (SDL_Color){0xff, 0xff, 0xff, 0xff});
-    refreshListUI();
+    ListUI_SetBackgroundColor(ui, (SDL_Color){0x05, 0x0d, 0x1c, 0xff});
+    ListUI_SetColumns(ui, ITEM_COLUMNS, (int[]){120, 200, 480, 0},
+		      (ListUI_Align[]){LISTUI_ALIGN_LEFT, LISTUI_ALIGN_RIGHT,
+				       LISTUI_ALIGN_RIGHT, LISTUI_ALIGN_LEFT});
+
+    // The list is populated before the first frame, later updates are
+    // read by the registry worker
+    OffAct_Snapshot(&table);
+    ApplySnapshot(&table);
+    if(OffAct_StartWorker()) {
+	printf("OffAct_StartWorker: %s\n", SDL_GetError());
+    }
+    OffAct_SetWatchInterval(WATCH_INTERVAL_MIN, WATCH_INTERVAL_MAX);
 
+    if(bench) {
+	RunBenchmark(renderer, font, bench);
+    }
+    ListUI_SetRenderPath(ui, path);
+    if(ListUI_SetPrefetch(ui, FONT_PATH, FONT_SIZE, PREFETCH_ROWS)) {
+	printf("ListUI_SetPrefetch: %s\n", SDL_GetError());
+    }
+
+    if(SDL_GetRendererOutputSize(renderer, &w, &h)) {
+	h = SCREEN_HEIGHT;
+    }
+
+    if(threaded) {
+	rc.renderer = renderer;
+	rc.font = font;
+	if(!(rc.wakeup=SDL_CreateSemaphore(0)) ||
+	   !(render_thread=SDL_CreateThread(RenderThread, "Render", &rc))) {
+	    printf("SDL_CreateThread: %s\n", SDL_GetError());
+	    threaded = SDL_FALSE;
+	}
+    }
+
+    // Only render when something changed, and sleep in between
     while(!quit) {
-	while(SDL_PollEvent(&event) != 0) {
-	    if(event.type == SDL_CONTROLLERBUTTONDOWN) {
-		switch(event.cbutton.button) {
-		case SDL_CONTROLLER_BUTTON_DPAD_UP:
-		    ListUI_NavigateItemUp(ui, SDL_FALSE, SDL_TRUE);
-		    break;
-		case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
-		    ListUI_NavigateItemDown(ui, SDL_FALSE, SDL_TRUE);
-		    break;
-		case SDL_CONTROLLER_BUTTON_A:
-		    ListUI_ActivateSelected(ui);
-		    break;
-                case SDL_CONTROLLER_BUTTON_B:
-                    quit = 1;
-                    break;
-		}
+	if(SDL_WaitEventTimeout(&event, GetWaitTimeout(last_frame))) {
+	    if(!stamp) {
+		stamp = SDL_GetPerformanceCounter();
 	    }
+	    do {
+		quit |= OnEvent(&event);
+	    } while(SDL_PollEvent(&event) != 0);
+
+	    // Events may leave items for the filter index, e.g., a new query
+	    indexing = SDL_TRUE;
+	} else if(indexing) {
+	    indexing = ListUI_BuildIndex(ui);
+	}
+
+	ApplyInput(SDL_GetTicks());
+	IME_Dialog_PullStatus();
+
+	// Input that changed nothing is not waiting for a frame
+	if(!ListUI_IsDirty(ui)) {
+	    stamp = 0;
+	    continue;
+	}
+
+	// Hand the changes to the render thread right away
+	if(threaded) {
+	    ListUI_Publish(ui, h, font, stamp);
+	    SDL_SemPost(rc.wakeup);
+	    stamp = 0;
+	    continue;
 	}
 
-	SDL_SetRenderDrawColor(renderer, 0x05, 0x0d, 0x1c, 0xff);
-	SDL_RenderClear(renderer);
+	if(SDL_GetTicks() - last_frame < 1000 / frame_rate_max) {
+	    continue;
+	}
 
 	ListUI_Render(ui, renderer, font);
 	SDL_RenderPresent(renderer);
+	last_frame = SDL_GetTicks();
+	RecordLatency(stamp);
+	stamp = 0;
+    }
 
-	IME_Dialog_PullStatus();
+    if(render_thread) {
+	SDL_AtomicSet(&rc.quit, 1);
+	SDL_SemPost(rc.wakeup);
+	SDL_WaitThread(render_thread, 0);
+    }
+    if(rc.wakeup) {
+	SDL_DestroySemaphore(rc.wakeup);
     }
 
+    OffAct_StopWorker();
+    LogRenderStats();
     ListUI_Destroy(ui);
     TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
@@ -14,6 +14,10 @@ You should have received a copy of the GNU General Public License
 along with this program; see the file COPYING. If not, see
 <http://www.gnu.org/licenses/>.  */
 
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
 #include "offact.h"
 
 
@@ -26,6 +30,47 @@ int sceRegMgrSetBin(int, const void*, size_t);
 int sceRegMgrSetStr(int, const char*, size_t);
 
 
+#define OFFACT_KIND_INT 0
+#define OFFACT_KIND_STR 1
+#define OFFACT_KIND_BIN 2
+
+
+/**
+ * Describes where a per-account field is stored in the registry, and where
+ * it is kept in an OffAct_Account. The entity number of a field of account
+ * n is base + (n - 1) * stride, and out of range accounts map to fallback.
+ **/
+typedef struct OffAct_FieldDesc {
+    int    base;
+    int    stride;
+    int    fallback;
+    int    kind;
+    size_t size;
+    size_t offset;
+} OffAct_FieldDesc;
+
+
+static const OffAct_FieldDesc schema[OFFACT_NB_FIELDS] = {
+    [OFFACT_FIELD_NAME]  = {125829632, 65536, 127140352, OFFACT_KIND_STR,
+			    ACCOUNT_NAME_MAX, offsetof(OffAct_Account, name)},
+    [OFFACT_FIELD_ID]    = {125830400, 65536, 127141120, OFFACT_KIND_BIN,
+			    sizeof(uint64_t), offsetof(OffAct_Account, id)},
+    [OFFACT_FIELD_TYPE]  = {125874183, 65536, 127184903, OFFACT_KIND_STR,
+			    ACCOUNT_TYPE_MAX, offsetof(OffAct_Account, type)},
+    [OFFACT_FIELD_FLAGS] = {125831168, 65536, 127141888, OFFACT_KIND_INT,
+			    sizeof(int), offsetof(OffAct_Account, flags)},
+};
+
+
+// Fields of each account as they were last read from, or written to, the
+// registry. Only the fields in the fields mask are cached.
+static struct {
+    OffAct_Account accounts[ACCOUNT_NUMB_MAX];
+    uint64_t       hits;
+    uint64_t       misses;
+} cache;
+
+
 static int OffAct_GetEntityNumber(int a, int b, int c, int d, int e)
 {
     if (a < 1 || a > b) {
@@ -46,63 +91,458 @@ uint64_t OffAct_GenAccountId(const char *name) {
 }
 
 
+/**
+ * Return the cached fields of an account, or NULL if the account number is
+ * out of range and its fields are not cached.
+ **/
+static OffAct_Account* OffAct_GetCached(int account_numb)
+{
+    if(account_numb < 1 || account_numb > ACCOUNT_NUMB_MAX) {
+	return 0;
+    }
+    return &cache.accounts[account_numb - 1];
+}
+
+
+/**
+ * Read a field of an account from the registry, bypassing the cache.
+ **/
+static int OffAct_ReadField(int account_numb, OffAct_Field f, void* val)
+{
+    const OffAct_FieldDesc* d = &schema[f];
+    int n = OffAct_GetEntityNumber(account_numb, ACCOUNT_NUMB_MAX, d->stride,
+				   d->base, d->fallback);
+    int err = -1;
+
+    memset(val, 0, d->size);
+    switch(d->kind) {
+    case OFFACT_KIND_INT:
+	err = sceRegMgrGetInt(n, val);
+	break;
+    case OFFACT_KIND_STR:
+	err = sceRegMgrGetStr(n, val, d->size);
+	break;
+    case OFFACT_KIND_BIN:
+	err = sceRegMgrGetBin(n, val, d->size);
+	break;
+    }
+
+    return err ? -1 : 0;
+}
+
+
+/**
+ * Read a field of an account, from the cache if possible.
+ **/
+static int OffAct_GetField(int account_numb, OffAct_Field f, void* val)
+{
+    const OffAct_FieldDesc* d = &schema[f];
+    OffAct_Account* c = OffAct_GetCached(account_numb);
+
+    if(c && (c->fields & OFFACT_FIELD_MASK(f))) {
+	memcpy(val, (char*)c + d->offset, d->size);
+	cache.hits++;
+	return 0;
+    }
+    cache.misses++;
+
+    if(OffAct_ReadField(account_numb, f, val)) {
+	return -1;
+    }
+    if(c) {
+	memcpy((char*)c + d->offset, val, d->size);
+	c->fields |= OFFACT_FIELD_MASK(f);
+    }
+    return 0;
+}
+
+
+/**
+ * Write a field of an account, and update the cache. A field that could not
+ * be written is dropped from the cache, since its state is unknown.
+ **/
+static int OffAct_SetField(int account_numb, OffAct_Field f, const void* val)
+{
+    const OffAct_FieldDesc* d = &schema[f];
+    OffAct_Account* c = OffAct_GetCached(account_numb);
+    int n = OffAct_GetEntityNumber(account_numb, ACCOUNT_NUMB_MAX, d->stride,
+				   d->base, d->fallback);
+    int err = -1;
+
+    switch(d->kind) {
+    case OFFACT_KIND_INT:
+	err = sceRegMgrSetInt(n, *(const int*)val);
+	break;
+    case OFFACT_KIND_STR:
+	err = sceRegMgrSetStr(n, val, d->size);
+	break;
+    case OFFACT_KIND_BIN:
+	err = sceRegMgrSetBin(n, val, d->size);
+	break;
+    }
+
+    if(!c) {
+	return err ? -1 : 0;
+    }
+    if(err) {
+	c->fields &= ~OFFACT_FIELD_MASK(f);
+	return -1;
+    }
+    memcpy((char*)c + d->offset, val, d->size);
+    c->fields |= OFFACT_FIELD_MASK(f);
+    return 0;
+}
+
+
+int OffAct_GetFields(OffAct_Account* accounts, int nb_accounts,
+		     unsigned mask)
+{
+    int err = 0;
+
+    // Fields are read one at a time for all accounts, so that reads of the
+    // same kind of registry entry are issued back to back
+    for(int f=0; f<OFFACT_NB_FIELDS; f++) {
+	if(!(mask & OFFACT_FIELD_MASK(f))) {
+	    continue;
+	}
+	for(int i=0; i<nb_accounts; i++) {
+	    if(OffAct_GetField(accounts[i].numb, f,
+			       (char*)&accounts[i] + schema[f].offset)) {
+		err = -1;
+		continue;
+	    }
+	    accounts[i].fields |= OFFACT_FIELD_MASK(f);
+	}
+    }
+
+    return err;
+}
+
+
+int OffAct_SetFields(const OffAct_Account* accounts, int nb_accounts,
+		     unsigned mask)
+{
+    for(int f=0; f<OFFACT_NB_FIELDS; f++) {
+	if(!(mask & OFFACT_FIELD_MASK(f))) {
+	    continue;
+	}
+	for(int i=0; i<nb_accounts; i++) {
+	    if(OffAct_SetField(accounts[i].numb, f,
+			       (const char*)&accounts[i] + schema[f].offset)) {
+		return -1;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+
 int OffAct_GetAccountName(int account_numb, char val[ACCOUNT_NAME_MAX])
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125829632U,
-				   127140352U);
-    *val = 0;
-    return sceRegMgrGetStr(n, val, ACCOUNT_NAME_MAX);
+    return OffAct_GetField(account_numb, OFFACT_FIELD_NAME, val);
 }
 
 
 int OffAct_GetAccountId(int account_numb, uint64_t* val)
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125830400U,
-				   127141120U);
-    *val = 0;
-    return sceRegMgrGetBin(n, val, sizeof(uint64_t));
+    return OffAct_GetField(account_numb, OFFACT_FIELD_ID, val);
 }
 
 
 int OffAct_SetAccountId(int account_numb, uint64_t val)
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125830400U,
-				   127141120U);
-    return sceRegMgrSetBin(n, &val, sizeof(uint64_t));
+    return OffAct_SetField(account_numb, OFFACT_FIELD_ID, &val);
 }
 
 
 int OffAct_GetAccountType(int account_numb, char val[ACCOUNT_TYPE_MAX])
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125874183U,
-				   127184903U);
-    *val = 0;
-    return sceRegMgrGetStr(n, val, ACCOUNT_TYPE_MAX);
+    return OffAct_GetField(account_numb, OFFACT_FIELD_TYPE, val);
 }
 
 
 int OffAct_SetAccountType(int account_numb, char val[ACCOUNT_TYPE_MAX])
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125874183U,
-				   127184903U);
-    return sceRegMgrSetStr(n, val, ACCOUNT_TYPE_MAX);
+    return OffAct_SetField(account_numb, OFFACT_FIELD_TYPE, val);
 }
 
 
 int OffAct_GetAccountFlags(int account_numb, int *val)
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125831168U,
-				   127141888U);
-    *val = 0;
-    return sceRegMgrGetInt(n, val);
+    return OffAct_GetField(account_numb, OFFACT_FIELD_FLAGS, val);
 }
 
 
 int OffAct_SetAccountFlags(int account_numb, int val)
 {
-    int n = OffAct_GetEntityNumber(account_numb, 16U, 65536U, 125831168U,
-				   127141888U);
-    return sceRegMgrSetInt(n, val);
+    return OffAct_SetField(account_numb, OFFACT_FIELD_FLAGS, &val);
+}
+
+
+/**
+ * Restore the id and type of an account after a failed transaction. Fields
+ * given as NULL were not written, and are left alone. Returns -1 if a field
+ * could not be restored, in which case the account is dropped from the
+ * cache, since its state in the registry is unknown.
+ **/
+static int OffAct_Rollback(int account_numb, const uint64_t* id,
+			   char type[ACCOUNT_TYPE_MAX])
+{
+    int err = 0;
+
+    if(type && OffAct_SetAccountType(account_numb, type)) {
+	err = -1;
+    }
+    if(id && OffAct_SetAccountId(account_numb, *id)) {
+	err = -1;
+    }
+    if(err) {
+	OffAct_InvalidateAccount(account_numb);
+    }
+
+    return err;
+}
+
+
+int OffAct_ApplyAccount(int account_numb, uint64_t id, const char* type,
+			int flags)
+{
+    char new_type[ACCOUNT_TYPE_MAX] = {0};
+    char old_type[ACCOUNT_TYPE_MAX];
+    uint64_t old_id;
+    int old_flags;
+    int id_changed, type_changed;
+    int writes = 0;
+
+    strncpy(new_type, type, ACCOUNT_TYPE_MAX - 1);
+
+    // Writes are elided and rolled back based on what the registry holds,
+    // which may have been changed by others since it was cached
+    OffAct_InvalidateAccount(account_numb);
+    if(OffAct_GetAccountId(account_numb, &old_id) ||
+       OffAct_GetAccountType(account_numb, old_type) ||
+       OffAct_GetAccountFlags(account_numb, &old_flags)) {
+	return -1;
+    }
+
+    id_changed = old_id != id;
+    type_changed = strncmp(old_type, new_type, ACCOUNT_TYPE_MAX) != 0;
+
+    // Fields are written in a fixed order, and those that were written
+    // are restored if a later write fails
+    if(id_changed) {
+	if(OffAct_SetAccountId(account_numb, id)) {
+	    return -1;
+	}
+	writes++;
+    }
+
+    if(type_changed) {
+	if(OffAct_SetAccountType(account_numb, new_type)) {
+	    return OffAct_Rollback(account_numb, id_changed ? &old_id : 0,
+				   0) ? -2 : -1;
+	}
+	writes++;
+    }
+
+    if(old_flags != flags) {
+	if(OffAct_SetAccountFlags(account_numb, flags)) {
+	    return OffAct_Rollback(account_numb, id_changed ? &old_id : 0,
+				   type_changed ? old_type : 0) ? -2 : -1;
+	}
+	writes++;
+    }
+
+    return writes;
+}
+
+
+void OffAct_InvalidateAccount(int account_numb)
+{
+    OffAct_Account* c = OffAct_GetCached(account_numb);
+
+    if(c) {
+	c->fields = 0;
+    }
+}
+
+
+void OffAct_InvalidateAll(void)
+{
+    for(int i=0; i<ACCOUNT_NUMB_MAX; i++) {
+	cache.accounts[i].fields = 0;
+    }
+}
+
+
+void OffAct_GetCacheStats(uint64_t* hits, uint64_t* misses)
+{
+    *hits = cache.hits;
+    *misses = cache.misses;
+}
+
+
+/**
+ * Fold a field into a 64-bit FNV-1a hash.
+ **/
+static uint64_t OffAct_Hash(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* p = data;
+
+    for(size_t i=0; i<size; i++) {
+	hash = (hash ^ p[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
+
+
+uint64_t OffAct_GetFingerprint(int account_numb, OffAct_Account* a)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    memset(a, 0, sizeof(OffAct_Account));
+    a->numb = account_numb;
+
+    // Empty accounts only have their name read, like OffAct_GetAccount
+    for(int f=0; f<OFFACT_NB_FIELDS; f++) {
+	if(f != OFFACT_FIELD_NAME && !*a->name) {
+	    break;
+	}
+	if(!OffAct_ReadField(account_numb, f,
+			     (char*)a + schema[f].offset)) {
+	    a->fields |= OFFACT_FIELD_MASK(f);
+	}
+    }
+
+    hash = OffAct_Hash(hash, &a->fields, sizeof(a->fields));
+    hash = OffAct_Hash(hash, a->name, sizeof(a->name));
+    hash = OffAct_Hash(hash, &a->id, sizeof(a->id));
+    hash = OffAct_Hash(hash, a->type, sizeof(a->type));
+    hash = OffAct_Hash(hash, &a->flags, sizeof(a->flags));
+
+    return hash;
+}
+
+
+static uint64_t OffAct_GetMicroseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+int OffAct_GetAccount(int account_numb, OffAct_Account* a)
+{
+    memset(a, 0, sizeof(OffAct_Account));
+    a->numb = account_numb;
+
+    if(OffAct_GetFields(a, 1, OFFACT_FIELD_MASK(OFFACT_FIELD_NAME)) ||
+       !*a->name) {
+	return -1;
+    }
+    return OffAct_GetFields(a, 1, OFFACT_FIELDS_ALL & ~a->fields);
+}
+
+
+int OffAct_Snapshot(OffAct_AccountTable* t)
+{
+    uint64_t start = OffAct_GetMicroseconds();
+    OffAct_Account all[ACCOUNT_NUMB_MAX];
+    uint64_t names;
+    OffAct_Account* a;
+    int nb = 0;
+
+    memset(t, 0, sizeof(OffAct_AccountTable));
+    memset(all, 0, sizeof(all));
+
+    // A snapshot reflects the registry as it is now
+    OffAct_InvalidateAll();
+
+    // Names tell which accounts are populated
+    for(int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
+	all[n - 1].numb = n;
+    }
+    OffAct_GetFields(all, ACCOUNT_NUMB_MAX,
+		     OFFACT_FIELD_MASK(OFFACT_FIELD_NAME));
+    for(int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
+	a = &all[n - 1];
+	if(!(a->fields & OFFACT_FIELD_MASK(OFFACT_FIELD_NAME))) {
+	    t->errors++;
+	} else if(*a->name) {
+	    t->accounts[t->nb_accounts++] = *a;
+	}
+    }
+    names = OffAct_GetMicroseconds();
+    t->timing.names_us = names - start;
+
+    // Only populated accounts have their remaining fields read
+    OffAct_GetFields(t->accounts, t->nb_accounts, OFFACT_FIELDS_ALL &
+		     ~OFFACT_FIELD_MASK(OFFACT_FIELD_NAME));
+    for(int i=0; i<t->nb_accounts; i++) {
+	a = &t->accounts[i];
+	if(a->fields != OFFACT_FIELDS_ALL) {
+	    t->errors++;
+	    continue;
+	}
+	t->populated |= 1U << (a->numb - 1);
+	if(i != nb) {
+	    t->accounts[nb] = *a;
+	}
+	nb++;
+    }
+    t->nb_accounts = nb;
+
+    t->timing.fields_us = OffAct_GetMicroseconds() - names;
+    t->timing.total_us = OffAct_GetMicroseconds() - start;
+
+    return t->nb_accounts;
+}
+
+
+int OffAct_ActivateAll(const char* type, int flags,
+		       OffAct_BatchResult results[ACCOUNT_NUMB_MAX],
+		       OffAct_AccountTable* t)
+{
+    OffAct_BatchResult* r;
+    OffAct_Account* a;
+    uint64_t start;
+    int nb;
+
+    OffAct_Snapshot(t);
+    nb = t->nb_accounts;
+
+    for(int i=0; i<nb; i++) {
+	a = &t->accounts[i];
+	r = &results[i];
+	r->numb = a->numb;
+	r->id = a->id ? a->id : OffAct_GenAccountId(a->name);
+
+	start = OffAct_GetMicroseconds();
+	r->writes = OffAct_ApplyAccount(r->numb, r->id, type, flags);
+	r->us = OffAct_GetMicroseconds() - start;
+    }
+
+    // Read back from the registry rather than the cache, so that writes
+    // that did not stick are noticed
+    OffAct_Snapshot(t);
+
+    for(int i=0; i<nb; i++) {
+	r = &results[i];
+	r->verified = -1;
+	for(int j=0; j<t->nb_accounts; j++) {
+	    a = &t->accounts[j];
+	    if(a->numb == r->numb && a->id == r->id && a->flags == flags &&
+	       !strncmp(a->type, type, ACCOUNT_TYPE_MAX)) {
+		r->verified = r->writes < 0 ? -1 : 0;
+	    }
+	}
+    }
+
+    return nb;
 }
 
 
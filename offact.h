@@ -38,6 +38,147 @@ int OffAct_GetAccountFlags(int account_numb, int *val);
 int OffAct_SetAccountFlags(int account_numb, int  val);
 
 
+/**
+ * Per-account registry fields, and masks to select a subset of them.
+ **/
+typedef enum OffAct_Field {
+    OFFACT_FIELD_NAME,
+    OFFACT_FIELD_ID,
+    OFFACT_FIELD_TYPE,
+    OFFACT_FIELD_FLAGS,
+    OFFACT_NB_FIELDS
+} OffAct_Field;
+
+#define OFFACT_FIELD_MASK(f) (1U << (f))
+#define OFFACT_FIELDS_ALL    ((1U << OFFACT_NB_FIELDS) - 1)
+
+
+/**
+ * An account as it is stored in the registry. The fields mask tells which
+ * fields hold values that were read.
+ **/
+typedef struct OffAct_Account {
+    int      numb;
+    unsigned fields;
+    uint64_t id;
+    int      flags;
+    char     type[ACCOUNT_TYPE_MAX];
+    char     name[ACCOUNT_NAME_MAX];
+} OffAct_Account;
+
+
+/**
+ * Read the fields in the given mask for each of the given accounts, whose
+ * numbers are taken from the numb member. Fields that were read are added
+ * to the fields mask of each account. Returns -1 if any field could not be
+ * read.
+ **/
+int OffAct_GetFields(OffAct_Account* accounts, int nb_accounts,
+		     unsigned fields);
+
+
+/**
+ * Write the fields in the given mask for each of the given accounts. Stops
+ * at the first write that fails, and returns -1 in that case.
+ **/
+int OffAct_SetFields(const OffAct_Account* accounts, int nb_accounts,
+		     unsigned fields);
+
+
+/**
+ * Update the id, type and flags of an account as a single transaction. The
+ * current values are read from the registry rather than the cache, fields
+ * that already have the given values are not written, and if a write fails,
+ * the fields written before it are restored. Returns the number of fields
+ * written, -1 on failure, or -2 if the fields could not be restored either,
+ * and the account may be left partially updated.
+ **/
+int OffAct_ApplyAccount(int account_numb, uint64_t id, const char* type,
+			int flags);
+
+
+/**
+ * Fields that are read with the functions above are cached, and fields that
+ * are written are updated in the cache as well. The cache is not aware of
+ * changes made to the registry by others, and must be invalidated to read
+ * them.
+ **/
+void OffAct_InvalidateAccount(int account_numb);
+void OffAct_InvalidateAll(void);
+
+
+/**
+ * Obtain the number of field reads that were served by the cache, and the
+ * number that had to be read from the registry.
+ **/
+void OffAct_GetCacheStats(uint64_t* hits, uint64_t* misses);
+
+
+/**
+ * Read a single account from the registry. Returns -1 if the account is
+ * empty, or if its fields cannot be read.
+ **/
+int OffAct_GetAccount(int account_numb, OffAct_Account* a);
+
+
+/**
+ * Read the fields of an account straight from the registry into the given
+ * account, without reading or updating the cache, and return a hash of
+ * them. Empty accounts only have their name read.
+ **/
+uint64_t OffAct_GetFingerprint(int account_numb, OffAct_Account* a);
+
+
+/**
+ * The accounts that were populated when a snapshot was taken, ordered by
+ * account number, together with the cost of taking it.
+ **/
+typedef struct OffAct_AccountTable {
+    OffAct_Account accounts[ACCOUNT_NUMB_MAX];
+    int            nb_accounts;
+    uint32_t       populated; // bit n-1 is set if account n is populated
+    int            errors;    // accounts that could not be read
+    struct {
+	uint64_t names_us;    // time spent finding populated accounts
+	uint64_t fields_us;   // time spent reading their remaining fields
+	uint64_t total_us;
+    } timing;
+} OffAct_AccountTable;
+
+
+/**
+ * Read all populated accounts from the registry in one pass. Accounts
+ * without a name are empty, and their other fields are not read. Accounts
+ * with fields that cannot be read are left out. Returns the number of
+ * accounts in the table.
+ **/
+int OffAct_Snapshot(OffAct_AccountTable* t);
+
+
+/**
+ * The outcome of activating an account as part of a batch.
+ **/
+typedef struct OffAct_BatchResult {
+    int      numb;
+    uint64_t id;       // the id that was applied
+    int      writes;   // return value of OffAct_ApplyAccount
+    int      verified; // 0 if the account reads back as applied, else -1
+    uint64_t us;       // time spent applying, in microseconds
+} OffAct_BatchResult;
+
+
+/**
+ * Activate all populated accounts with the given type and flags in one
+ * pass. Accounts without an id get one from OffAct_GenAccountId. Once all
+ * accounts are written, they are read back into the given table, and
+ * checked against what was applied. Returns the number of accounts in the
+ * results.
+ **/
+int OffAct_ActivateAll(const char* type, int flags,
+		       OffAct_BatchResult results[ACCOUNT_NUMB_MAX],
+		       OffAct_AccountTable* t);
+
+
 /* Local Variables: */
 /* tab-width: 8 */
 /* c-basic-offset: 4 */
@@ -0,0 +1,401 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#include "offact_worker.h"
+
+
+#define WORKER_QUEUE_SIZE 64 // must be a power of two
+#define WORKER_RETRY_MS   10 // wait between attempts to deliver a job
+
+
+/**
+ * Jobs that were queued by the main thread, and have not run yet. The main
+ * thread is the only producer, and the worker the only consumer.
+ **/
+static struct {
+    OffAct_Job*  jobs[WORKER_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} queue;
+
+
+static struct {
+    SDL_Thread   *thread;
+    SDL_sem      *wakeup;
+    SDL_atomic_t  quit;
+    SDL_atomic_t  watch_min;
+    SDL_atomic_t  watch_max;
+    Uint32        event_type;
+} worker;
+
+
+/**
+ * Fingerprints of the accounts as of the last poll, and when to poll next.
+ * Only accessed by the worker.
+ **/
+static struct {
+    uint64_t prints[ACCOUNT_NUMB_MAX];
+    SDL_bool baseline;
+    Uint32   interval;
+    Uint32   next;
+} watch;
+
+
+static SDL_bool OffAct_Push(OffAct_Job* job)
+{
+    unsigned tail = (unsigned)SDL_AtomicGet(&queue.tail);
+    unsigned head = (unsigned)SDL_AtomicGet(&queue.head);
+
+    if(tail - head >= WORKER_QUEUE_SIZE) {
+	return SDL_FALSE;
+    }
+
+    queue.jobs[tail & (WORKER_QUEUE_SIZE - 1)] = job;
+    SDL_AtomicSet(&queue.tail, (int)(tail + 1));
+
+    return SDL_TRUE;
+}
+
+
+static OffAct_Job* OffAct_Pop(void)
+{
+    unsigned head = (unsigned)SDL_AtomicGet(&queue.head);
+    unsigned tail = (unsigned)SDL_AtomicGet(&queue.tail);
+    OffAct_Job* job;
+
+    if(head == tail) {
+	return 0;
+    }
+
+    job = queue.jobs[head & (WORKER_QUEUE_SIZE - 1)];
+    SDL_AtomicSet(&queue.head, (int)(head + 1));
+
+    return job;
+}
+
+
+/**
+ * Hand a finished job to the main thread through the event queue, and wait
+ * while the event queue is full if asked to, since the main thread may count
+ * on the job, e.g., to clear writes in flight. Returns -1 if the job cannot
+ * be delivered, in which case it is freed.
+ **/
+static int OffAct_Deliver(OffAct_Job* job, SDL_bool wait)
+{
+    SDL_Event event = {0};
+    int r;
+
+    event.type = worker.event_type;
+    event.user.code = job->kind;
+    event.user.data1 = job;
+    while((r=SDL_PushEvent(&event)) < 0 && wait &&
+	  !SDL_AtomicGet(&worker.quit)) {
+	SDL_Delay(WORKER_RETRY_MS);
+    }
+    if(r != 1) {
+	SDL_free(job);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Allocate a job of the given kind.
+ **/
+static OffAct_Job* OffAct_CreateJob(OffAct_JobKind kind, void* ctx)
+{
+    OffAct_Job* job = SDL_calloc(1, sizeof(OffAct_Job));
+
+    if(job) {
+	job->kind = kind;
+	job->ctx = ctx;
+    }
+
+    return job;
+}
+
+
+/**
+ * Record the fingerprint of an account that the worker wrote itself, so
+ * that the next poll does not report the write as a change made by others.
+ * The account is read into the given one.
+ **/
+static void OffAct_Rebase(int account_numb, OffAct_Account* a)
+{
+    uint64_t print = OffAct_GetFingerprint(account_numb, a);
+
+    if(account_numb >= 1 && account_numb <= ACCOUNT_NUMB_MAX) {
+	watch.prints[account_numb - 1] = print;
+    }
+}
+
+
+/**
+ * Run a job, and deliver it. Returns -1 if the job cannot be delivered.
+ **/
+static int OffAct_RunJob(OffAct_Job* job, SDL_bool wait)
+{
+    OffAct_Account a;
+
+    switch(job->kind) {
+    case OFFACT_JOB_SNAPSHOT:
+	job->result = OffAct_Snapshot(&job->table);
+	break;
+
+    case OFFACT_JOB_APPLY:
+	job->result = OffAct_ApplyAccount(job->account.numb, job->account.id,
+					  job->account.type,
+					  job->account.flags);
+
+	// Report what the registry holds, even after a rollback
+	OffAct_Rebase(job->account.numb, &job->account);
+	break;
+
+    case OFFACT_JOB_BATCH:
+	job->result = OffAct_ActivateAll(job->account.type, job->account.flags,
+					 job->results, &job->table);
+	for(int i=0; i<job->result; i++) {
+	    OffAct_Rebase(job->results[i].numb, &a);
+	}
+	break;
+
+    case OFFACT_JOB_CHANGE:
+	break;
+    }
+
+    return OffAct_Deliver(job, wait);
+}
+
+
+/**
+ * Fingerprint all accounts, and report those that changed since the last
+ * poll, as they were read for their fingerprint. The first poll only
+ * records the fingerprints.
+ **/
+static void OffAct_Watch(void)
+{
+    Uint32 min = (Uint32)SDL_AtomicGet(&worker.watch_min);
+    Uint32 max = (Uint32)SDL_AtomicGet(&worker.watch_max);
+    SDL_bool changed = SDL_FALSE;
+    OffAct_Job* job;
+    OffAct_Account a;
+    uint64_t print;
+
+    for(int n=1; n<=ACCOUNT_NUMB_MAX; n++) {
+	print = OffAct_GetFingerprint(n, &a);
+	if(watch.baseline && print != watch.prints[n - 1]) {
+	    changed = SDL_TRUE;
+	    if((job=OffAct_CreateJob(OFFACT_JOB_CHANGE, 0))) {
+		job->account = a;
+		job->result = *a.name && a.fields == OFFACT_FIELDS_ALL ? 0 : -1;
+		OffAct_Deliver(job, SDL_TRUE);
+	    }
+	}
+	watch.prints[n - 1] = print;
+    }
+    watch.baseline = SDL_TRUE;
+
+    // Changes tend to come in bursts, e.g., while another tool is
+    // activating accounts, so poll often right after one
+    if(changed || watch.interval < min) {
+	watch.interval = min;
+    } else {
+	watch.interval = SDL_min(watch.interval * 2, SDL_max(min, max));
+    }
+    watch.next = SDL_GetTicks() + watch.interval;
+}
+
+
+/**
+ * Compute how long the worker may sleep before it polls the registry.
+ **/
+static Uint32 OffAct_GetWatchTimeout(void)
+{
+    Uint32 now = SDL_GetTicks();
+
+    if(!SDL_AtomicGet(&worker.watch_min)) {
+	return SDL_MUTEX_MAXWAIT;
+    }
+    if(!watch.interval || SDL_TICKS_PASSED(now, watch.next)) {
+	return 0;
+    }
+
+    return watch.next - now;
+}
+
+
+static int OffAct_RunWorker(void* ctx)
+{
+    OffAct_Job* job;
+
+    while(!SDL_AtomicGet(&worker.quit)) {
+	if(SDL_SemWaitTimeout(worker.wakeup, OffAct_GetWatchTimeout()) &&
+	   SDL_AtomicGet(&worker.watch_min)) {
+	    OffAct_Watch();
+	}
+	while(!SDL_AtomicGet(&worker.quit) && (job=OffAct_Pop())) {
+	    OffAct_RunJob(job, SDL_TRUE);
+	}
+    }
+
+    return 0;
+}
+
+
+int OffAct_StartWorker(void)
+{
+    if(!worker.event_type) {
+	if((worker.event_type=SDL_RegisterEvents(1)) == (Uint32)-1) {
+	    worker.event_type = 0;
+	    return -1;
+	}
+    }
+
+    SDL_AtomicSet(&worker.quit, 0);
+    if(!(worker.wakeup=SDL_CreateSemaphore(0))) {
+	return -1;
+    }
+    if(!(worker.thread=SDL_CreateThread(OffAct_RunWorker, "Registry", 0))) {
+	SDL_DestroySemaphore(worker.wakeup);
+	worker.wakeup = 0;
+	return -1;
+    }
+
+    return 0;
+}
+
+
+void OffAct_StopWorker(void)
+{
+    OffAct_Job* job;
+
+    if(!worker.thread) {
+	return;
+    }
+
+    SDL_AtomicSet(&worker.quit, 1);
+    SDL_SemPost(worker.wakeup);
+    SDL_WaitThread(worker.thread, 0);
+    SDL_DestroySemaphore(worker.wakeup);
+    worker.thread = 0;
+    worker.wakeup = 0;
+
+    while((job=OffAct_Pop())) {
+	SDL_free(job);
+    }
+}
+
+
+void OffAct_SetWatchInterval(Uint32 min_ms, Uint32 max_ms)
+{
+    SDL_AtomicSet(&worker.watch_min, (int)min_ms);
+    SDL_AtomicSet(&worker.watch_max, (int)max_ms);
+
+    if(worker.thread) {
+	SDL_SemPost(worker.wakeup);
+    }
+}
+
+
+Uint32 OffAct_GetEventType(void)
+{
+    return worker.event_type;
+}
+
+
+/**
+ * Hand a job to the worker, or run it right away if there is no worker, in
+ * which case the main thread cannot wait for room in the event queue.
+ **/
+static int OffAct_Queue(OffAct_Job* job)
+{
+    if(!worker.event_type) {
+	SDL_free(job);
+	return -1;
+    }
+
+    if(!worker.thread) {
+	return OffAct_RunJob(job, SDL_FALSE);
+    }
+
+    if(!OffAct_Push(job)) {
+	SDL_free(job);
+	return -1;
+    }
+
+    SDL_SemPost(worker.wakeup);
+
+    return 0;
+}
+
+
+int OffAct_QueueSnapshot(void* ctx)
+{
+    OffAct_Job* job = OffAct_CreateJob(OFFACT_JOB_SNAPSHOT, ctx);
+
+    if(!job) {
+	return -1;
+    }
+
+    return OffAct_Queue(job);
+}
+
+
+int OffAct_QueueApply(int account_numb, uint64_t id, const char* type,
+		      int flags, void* ctx)
+{
+    OffAct_Job* job = OffAct_CreateJob(OFFACT_JOB_APPLY, ctx);
+
+    if(!job) {
+	return -1;
+    }
+
+    job->account.numb = account_numb;
+    job->account.id = id;
+    job->account.flags = flags;
+    SDL_strlcpy(job->account.type, type, ACCOUNT_TYPE_MAX);
+
+    return OffAct_Queue(job);
+}
+
+
+int OffAct_QueueActivateAll(const char* type, int flags, void* ctx)
+{
+    OffAct_Job* job = OffAct_CreateJob(OFFACT_JOB_BATCH, ctx);
+
+    if(!job) {
+	return -1;
+    }
+
+    job->account.flags = flags;
+    SDL_strlcpy(job->account.type, type, ACCOUNT_TYPE_MAX);
+
+    return OffAct_Queue(job);
+}
+
+
+void OffAct_ReleaseJob(OffAct_Job* job)
+{
+    SDL_free(job);
+}
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */
@@ -0,0 +1,134 @@
+/* Copyright (C) 2024 John Törnblom
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; see the file COPYING. If not, see
+<http://www.gnu.org/licenses/>.  */
+
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include "offact.h"
+
+/**
+ * The registry worker runs registry reads and writes on a background
+ * thread, so that a slow registry never stalls input or rendering. Jobs are
+ * queued by the main thread, and each finished job is delivered back to it
+ * as an SDL user event of the type returned by OffAct_GetEventType, with the
+ * job in data1, e.g.,
+ *
+ *  OffAct_QueueSnapshot(ctx);
+ *  ...
+ *  if(event.type == OffAct_GetEventType()) {
+ *      OffAct_Job* job = event.user.data1;
+ *      // use job->table
+ *      OffAct_ReleaseJob(job);
+ *  }
+ *
+ * The functions in offact.h are not thread safe, and must not be called by
+ * others while the worker is running.
+ **/
+
+
+typedef enum OffAct_JobKind
+{
+    OFFACT_JOB_SNAPSHOT, // take a snapshot of all accounts
+    OFFACT_JOB_APPLY,    // apply the id, type and flags of an account
+    OFFACT_JOB_CHANGE,   // an account was changed by someone else
+    OFFACT_JOB_BATCH,    // activate all populated accounts
+} OffAct_JobKind;
+
+
+/**
+ * A registry job, and its result once it has been delivered.
+ **/
+typedef struct OffAct_Job
+{
+    OffAct_JobKind      kind;
+    void               *ctx;
+    int                 result;  // return value of the registry call
+    OffAct_Account      account; // the account as read after the job ran
+    OffAct_AccountTable table;   // the snapshot taken by a snapshot job
+    OffAct_BatchResult  results[ACCOUNT_NUMB_MAX]; // outcome of a batch job
+} OffAct_Job;
+
+
+/**
+ * Register the event type, and start the worker thread. If the thread
+ * cannot be started, -1 is returned, and jobs run when they are queued
+ * instead. Their events are still delivered through the event queue, and
+ * the queue functions below return -1 if an event cannot be pushed. The
+ * worker itself waits for room in the event queue, so that every job it
+ * runs is delivered.
+ **/
+int OffAct_StartWorker(void);
+
+
+/**
+ * Stop the worker thread, and drop the jobs that have not run yet.
+ **/
+void OffAct_StopWorker(void);
+
+
+/**
+ * Watch the accounts for changes made by others while the worker is idle.
+ * The registry is polled every min_ms milliseconds after a change, and the
+ * interval doubles up to max_ms while nothing changes. Each account that
+ * changed is delivered as a job of kind OFFACT_JOB_CHANGE, with the account
+ * as it was read for its fingerprint. The result of the job is -1 if the
+ * account is now empty, or cannot be read. Writes made by the worker itself
+ * are not reported. A min_ms of zero stops watching.
+ **/
+void OffAct_SetWatchInterval(Uint32 min_ms, Uint32 max_ms);
+
+
+/**
+ * Return the type of the events that deliver finished jobs.
+ **/
+Uint32 OffAct_GetEventType(void);
+
+
+/**
+ * Queue a snapshot of all accounts. Returns -1 if the queue is full.
+ **/
+int OffAct_QueueSnapshot(void* ctx);
+
+
+/**
+ * Queue an update of the id, type and flags of an account, see
+ * OffAct_ApplyAccount. The account is read back once it has been updated.
+ * Returns -1 if the queue is full.
+ **/
+int OffAct_QueueApply(int account_numb, uint64_t id, const char* type,
+		      int flags, void* ctx);
+
+
+/**
+ * Queue the activation of all populated accounts with the given type and
+ * flags, see OffAct_ActivateAll. The result of the job is the number of
+ * accounts in its results, and its table holds the accounts as they were
+ * read back. Returns -1 if the queue is full.
+ **/
+int OffAct_QueueActivateAll(const char* type, int flags, void* ctx);
+
+
+/**
+ * Free a job that was delivered with an event.
+ **/
+void OffAct_ReleaseJob(OffAct_Job* job);
+
+
+/* Local Variables: */
+/* tab-width: 8 */
+/* c-basic-offset: 4 */
+/* End: */